@@ -0,0 +1,175 @@
+// Copyright 2020 Pslydhh. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Read tail latency of ConcurrentHashMap::find while writers keep doubling the
+// table: readers look up a fixed set of hot keys (always present) and time every
+// call, so each sample may have to hop through one or more ForwardingObjects.
+//
+// Two more runs time find on a single deep TreeBin: once with colliding keys
+// that have no operator<, where findTreeNode has to descend into both subtrees
+// of every node, and once with colliding longs, which the bin keeps ordered.
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "concurrent_hash_map.hpp"
+
+static const long HOT_KEYS = 1024;
+static const long COLLIDING_KEYS = 512;
+static const size_t MAX_SAMPLES_PER_READER = 1 << 22;
+
+long n_const;
+long nthreads_const;
+
+static int64_t percentile(const std::vector<int64_t>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1));
+    return sorted[index];
+}
+
+// merges the per-thread samples and prints their count and percentiles.
+static void report_latency(const std::vector<std::vector<int64_t>>& samples) {
+    std::vector<int64_t> all;
+    for (auto& local : samples) {
+        all.insert(all.end(), local.begin(), local.end());
+    }
+    std::sort(all.begin(), all.end());
+
+    std::cout << "find samples: " << all.size() << std::endl;
+    std::cout << "find latency p50: " << percentile(all, 0.50)
+              << " ns, p99: " << percentile(all, 0.99)
+              << " ns, p99.9: " << percentile(all, 0.999)
+              << " ns, max: " << (all.empty() ? 0 : all.back()) << " ns" << std::endl;
+}
+
+void bench_find_during_resize(long count, long num) {
+    ConcurrentHashMap<long, long> conMap;
+    std::vector<std::thread> threads;
+    std::vector<std::vector<int64_t>> samples(num);
+    std::atomic<long> writers_left(num);
+
+    for (long key = 0; key < HOT_KEYS; ++key) {
+        conMap.insertAbsent(-key - 1, key);
+    }
+
+    auto beginTime = std::chrono::high_resolution_clock::now();
+    for (long i = 0; i < num; ++i) {
+        threads.emplace_back([&conMap, &writers_left, count, num, i]() -> void {
+            // distinct keys per writer, so the table keeps growing.
+            for (long j = 0; j < count / num; ++j) {
+                conMap.insertAbsent(j * num + i, j);
+            }
+            writers_left.fetch_sub(1);
+        });
+        threads.emplace_back([&conMap, &writers_left, &samples, i]() -> void {
+            std::vector<int64_t>& local = samples[i];
+            local.reserve(MAX_SAMPLES_PER_READER);
+            long key = i;
+            while (writers_left.load() > 0 && local.size() < MAX_SAMPLES_PER_READER) {
+                long value = -1;
+                auto begin = std::chrono::steady_clock::now();
+                bool r = conMap.find(-(key % HOT_KEYS) - 1, &value);
+                auto end = std::chrono::steady_clock::now();
+                assert(r && value == key % HOT_KEYS);
+                (void)r;
+                local.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+                ++key;
+            }
+        });
+    }
+    for (std::thread& th : threads) th.join();
+    auto endTime = std::chrono::high_resolution_clock::now();
+    auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - beginTime);
+
+    std::cout << "insert " << count << " keys with " << num << " writers / " << num
+              << " readers, elapsed time is " << elapsedTime.count() << " milliseconds" << std::endl;
+    report_latency(samples);
+}
+
+struct CollidingKey {
+    long v;
+
+    bool operator==(const CollidingKey& o) const { return v == o.v; }
+};
+
+struct CollidingKeyHash {
+    size_t operator()(const CollidingKey&) const { return 42; }
+};
+
+struct CollidingHash {
+    size_t operator()(long) const { return 42; }
+};
+
+template <typename Key, typename KeyHash>
+void bench_find_colliding(long count, long num, const char* kind) {
+    ConcurrentHashMap<Key, long, KeyHash> conMap;
+    std::vector<std::thread> threads;
+    std::vector<std::vector<int64_t>> samples(num);
+
+    for (long key = 0; key < COLLIDING_KEYS; ++key) {
+        conMap.insertAbsent(Key{key}, key);
+    }
+
+    auto beginTime = std::chrono::high_resolution_clock::now();
+    for (long i = 0; i < num; ++i) {
+        threads.emplace_back([&conMap, &samples, count, num, i]() -> void {
+            std::vector<int64_t>& local = samples[i];
+            long lookups = std::min(count / num, static_cast<long>(MAX_SAMPLES_PER_READER));
+            local.reserve(lookups);
+            for (long j = 0; j < lookups; ++j) {
+                // every other lookup misses and has to visit the whole tree.
+                long key = (j % 2 == 0) ? (j / 2) % COLLIDING_KEYS : -j;
+                long value = -1;
+                auto begin = std::chrono::steady_clock::now();
+                bool r = conMap.find(Key{key}, &value);
+                auto end = std::chrono::steady_clock::now();
+                assert(r == (key >= 0) && (!r || value == key));
+                (void)r;
+                local.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+            }
+        });
+    }
+    for (std::thread& th : threads) th.join();
+    auto endTime = std::chrono::high_resolution_clock::now();
+    auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - beginTime);
+
+    std::cout << "find in a TreeBin of " << COLLIDING_KEYS << " colliding " << kind << " keys with " << num
+              << " readers, elapsed time is " << elapsedTime.count() << " milliseconds" << std::endl;
+    report_latency(samples);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "usage: " << argv[0] << " times n nthreads" << std::endl;
+        return 1;
+    }
+    int times = atoi(argv[1]);
+    n_const = atoi(argv[2]);
+    nthreads_const = atoi(argv[3]);
+    for (int i = 0; i < times; ++i) {
+        std::thread thread([]() -> void {
+            bench_find_during_resize(n_const, nthreads_const);
+            bench_find_colliding<CollidingKey, CollidingKeyHash>(n_const, nthreads_const, "unordered");
+            bench_find_colliding<long, CollidingHash>(n_const, nthreads_const, "ordered");
+        });
+        thread.join();
+    }
+
+    return 0;
+}
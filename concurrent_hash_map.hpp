@@ -1,9 +1,82 @@
+#include <memory>
+#include <string>
+#include <string_view>
 #include "sebr_local.hpp"
 
 using namespace sebr;
+
+/**
+* Transparent hash for std::string keys. It hashes anything viewable as
+* a std::string_view exactly like std::hash<std::string>, so a
+* ConcurrentHashMap<std::string, V, StringHash, std::equal_to<>> can be
+* searched with a std::string_view or a const char* without building a
+* std::string.
+*/
+struct StringHash {
+    using is_transparent = void;
+
+    size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+};
+
 template <typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
-class ConcurrentHashMap final : public ConcurrentBridge<ConcurrentHashMap<K, V, Hash>> {
+class ConcurrentHashMap final : public ConcurrentBridge<ConcurrentHashMap<K, V, Hash, KeyEqual>> {
+public:
+    /**
+    * Runs a task on a thread of the caller's choosing; used to hand out
+    * stripes of a table that is being torn down.
+    */
+    using Executor = std::function<void(std::function<void()>)>;
+
 private:
+    using Bridge = ConcurrentBridge<ConcurrentHashMap>;
+
+    template <typename T, typename = void>
+    struct IsTransparent : std::false_type {};
+
+    template <typename T>
+    struct IsTransparent<T, std::void_t<typename T::is_transparent>> : std::true_type {};
+
+    /**
+    * Enables the heterogeneous overloads for lookup keys other than K,
+    * when both Hash and KeyEqual are transparent.
+    */
+    template <typename Q, typename H = Hash, typename E = KeyEqual>
+    using TransparentKey = std::enable_if_t<IsTransparent<H>::value && IsTransparent<E>::value &&
+                                            !std::is_same<std::decay_t<Q>, K>::value>;
+
+    template <typename A, typename B, typename = void>
+    struct IsOrdered : std::false_type {};
+
+    template <typename A, typename B>
+    struct IsOrdered<A, B, std::void_t<decltype(bool(std::declval<const A&>() < std::declval<const B&>())),
+                                       decltype(bool(std::declval<const B&>() < std::declval<const A&>()))>>
+            : std::true_type {};
+
+    /**
+    * operator< is only known to agree with the map's notion of equality
+    * when that is the standard one. A custom KeyEqual (case-insensitive
+    * strings, say) may call two keys equal that operator< tells apart,
+    * and ordering a tree bin by it would hide the equal key.
+    */
+    static constexpr bool STANDARD_KEY_EQUAL =
+            std::is_same<KeyEqual, std::equal_to<K>>::value || std::is_same<KeyEqual, std::equal_to<>>::value;
+
+    /**
+    * Orders two keys whose hashes are equal, like Java's
+    * compareComparables: by operator< when the keys provide one and
+    * KeyEqual is the standard equality, so tree bins of colliding keys
+    * stay searchable in O(log n). Returns 0 otherwise; then both
+    * subtrees have to be searched.
+    */
+    template <typename Q>
+    static int compareKeys(const Q& k, const K& pk) {
+        if constexpr (STANDARD_KEY_EQUAL && IsOrdered<Q, K>::value) {
+            return (k < pk) ? -1 : (pk < k) ? 1 : 0;
+        } else {
+            return 0;
+        }
+    }
+
     class DelayDispose {
     public:
         DelayDispose() : ptr(nullptr) {}
@@ -17,13 +90,13 @@ private:
         std::function<void()> ptr;
     };
 
-    static const int MOVED = -1;    // hash for forwarding nodes
-    static const int TREEBIN = -2;  // hash for roots of trees
-    static const int RESERVED = -3; // hash for transient reservations
-    static const int HASH_BITS = 0x7fffffff;
+    static const int64_t MOVED = -1;    // hash for forwarding nodes
+    static const int64_t TREEBIN = -2;  // hash for roots of trees
+    static const int64_t RESERVED = -3; // hash for transient reservations
+    static const int64_t HASH_BITS = 0x7fffffffffffffffLL;
     unsigned int NCPU = std::thread::hardware_concurrency();
-    static const int DEFAULT_CAPACITY = 16;
-    static const int MAXIMUM_CAPACITY = 1 << 30;
+    static const int64_t DEFAULT_CAPACITY = 16;
+    static const int64_t MAXIMUM_CAPACITY = 1LL << 62;
 
     /**
     * Minimum number of rebinnings per transfer step. Ranges are
@@ -32,24 +105,30 @@ private:
     * excessive memory contention.  The value should be at least
     * DEFAULT_CAPACITY.
     */
-    static const int MIN_TRANSFER_STRIDE = 16;
+    static const int64_t MIN_TRANSFER_STRIDE = 16;
+
+    /**
+    * Number of bins a thread claims at a time when a dropped table is
+    * torn down in parallel.
+    */
+    static const int64_t DISPOSE_STRIDE = 1 << 12;
 
     /**
     * The number of bits used for generation stamp in sizeCtl.
-    * Must be at least 6 for 32bit arrays.
+    * Must be at least 7 for 64bit arrays.
     */
-    static const int RESIZE_STAMP_BITS = 16;
+    static const int RESIZE_STAMP_BITS = 32;
 
     /**
     * The maximum number of threads that can help resize.
-    * Must fit in 32 - RESIZE_STAMP_BITS bits.
+    * Must fit in 64 - RESIZE_STAMP_BITS bits.
     */
-    static const int MAX_RESIZERS = (1 << (32 - RESIZE_STAMP_BITS)) - 1;
+    static const int64_t MAX_RESIZERS = (1LL << (64 - RESIZE_STAMP_BITS)) - 1;
 
     /**
     * The bit shift for recording size stamp in sizeCtl.
     */
-    static const int RESIZE_STAMP_SHIFT = 32 - RESIZE_STAMP_BITS;
+    static const int RESIZE_STAMP_SHIFT = 64 - RESIZE_STAMP_BITS;
 
     /**
     * The bin count threshold for using a tree rather than list for a
@@ -76,8 +155,87 @@ private:
     */
     static const int MIN_TREEIFY_CAPACITY = 64;
 
+    /**
+    * Depth of the explicit stack findTreeNode uses to remember the
+    * subtrees it still has to visit when equal hashes force a search
+    * of both sides. A red-black tree this deep never fits in memory.
+    */
+    static const int FIND_STACK_DEPTH = 128;
+
+    /**
+    * Number of nodes an unlocked tree search visits between checks of
+    * its TreeBin's version.
+    */
+    static const unsigned int VALIDATE_STEPS = 64;
+
+    /**
+    * The increment for generating probe values, used to pick a
+    * CounterCell for the calling thread.
+    */
+    static const unsigned int PROBE_INCREMENT = 0x9e3779b9;
+
+    /**
+    * Number of bin lock stripes per CPU, and the upper bound on the
+    * total number of stripes.
+    */
+    static const int LOCK_STRIPES_PER_CPU = 16;
+    static const int MAX_LOCK_STRIPES = 1 << 12;
+
+    class alignas(64) PaddedMutex {
+    public:
+        std::mutex mtx;
+    };
+
+    /**
+    * A fixed power-of-two set of padded bin locks shared by every
+    * table of the map: bin i of any table is guarded by stripe
+    * i & mask. A thread never holds more than one bin lock at a
+    * time, so sharing stripes between tables cannot deadlock, and
+    * creating a table no longer allocates any locks.
+    */
+    class LockStripes {
+    public:
+        PaddedMutex* locks;
+        int mask;
+
+    public:
+        LockStripes(int n) : locks(new PaddedMutex[n]), mask(n - 1) {}
+
+        ~LockStripes() { delete[] locks; }
+
+        std::mutex& at(int64_t i) { return locks[i & mask].mtx; }
+    };
+
+    /**
+    * A padded cell for distributing counts. Adapted from LongAdder
+    * and Striped64. Each cell owns a whole cache line so that writers
+    * hashed to different cells never contend.
+    */
+    class alignas(64) CounterCell {
+    public:
+        std::atomic<long> value;
+
+    public:
+        CounterCell(long x) : value(x) {}
+    };
+
+    /**
+    * Table of CounterCells. Cells are shared between the old and new
+    * table on expansion, so the table only owns the array itself.
+    */
+    class CounterCellTable {
+    public:
+        std::atomic<CounterCell*>* cells;
+        int length;
+
+    public:
+        CounterCellTable(int n) : cells(new std::atomic<CounterCell*>[n]()), length(n) {}
+
+        ~CounterCellTable() { delete[] cells; }
+    };
+
     class Node;
-    class RecSomeNode : public ReclaimBridge<RecSomeNode>/*, public Stock<RecSomeNode, 1000>*/ {
+    class RecSomeNode : public ReclaimBridge<RecSomeNode> {
     public:
         Node* first;
 
@@ -95,7 +253,7 @@ private:
     };
 
     class TreeBin;
-    class RecTreeBin : public ReclaimBridge<RecTreeBin>/*, public Stock<RecTreeBin, 1000>*/ {
+    class RecTreeBin : public ReclaimBridge<RecTreeBin> {
     public:
         TreeBin* treeBin;
 
@@ -107,10 +265,9 @@ private:
                 TreeNode* link_start = treeBin->first;
                 delete treeBin;
 
-                Node* temp = link_start;
+                TreeNode* temp = link_start;
                 while (temp != nullptr) {
-                    // assert(dynamic_cast<ForwardingObject*> (temp) == nullptr);
-                    Node* next = temp->next;
+                    TreeNode* next = static_cast<TreeNode*>(temp->next.load());
                     delete temp;
                     temp = next;
                 }
@@ -118,7 +275,7 @@ private:
         }
     };
 
-    class RecLinkedNode : public ReclaimBridge<RecLinkedNode>/*, public Stock<RecLinkedNode, 1000>*/ {
+    class RecLinkedNode : public ReclaimBridge<RecLinkedNode> {
     public:
         //friend class ConcurrentHashMap;
         Node* link_start;
@@ -131,7 +288,7 @@ private:
         void reclaim() {
             Node* temp = link_start;
             while (temp != link_end) {
-                // assert(dynamic_cast<ForwardingObject*> (temp) == nullptr);
+                assert(temp->hash >= 0);
                 Node* next = temp->next;
                 delete temp;
                 temp = next;
@@ -140,12 +297,12 @@ private:
     };
 
     class TreeNode;
-    class RecPartialTree : public ReclaimBridge<RecPartialTree>/*, public Stock<RecPartialTree, 1000>*/ {
+    class RecPartialTree : public ReclaimBridge<RecPartialTree> {
     public:
         //friend class ConcurrentHashMap;
         TreeBin* tree_bin;
-        Node* lo;
-        Node* hi;
+        TreeNode* lo;
+        TreeNode* hi;
         static const int len = 2;
 
     public:
@@ -157,21 +314,20 @@ private:
                 TreeNode* link_start = tree_bin->first;
                 delete tree_bin;
 
-                Node* temp = link_start;
+                TreeNode* temp = link_start;
                 while (temp != nullptr) {
-                    // assert(dynamic_cast<ForwardingObject*> (temp) == nullptr);
-                    Node* next = temp->next;
+                    TreeNode* next = static_cast<TreeNode*>(temp->next.load());
                     delete temp;
                     temp = next;
                 }
             }
 
-            Node* nodes[len] = {lo, hi};
-            for (Node* node : nodes) {
+            TreeNode* nodes[len] = {lo, hi};
+            for (TreeNode* node : nodes) {
                 if (node != nullptr) {
-                    Node* temp = node;
+                    TreeNode* temp = node;
                     while (temp != nullptr) {
-                        Node* next = temp->next;
+                        TreeNode* next = static_cast<TreeNode*>(temp->next.load());
                         delete temp;
                         temp = next;
                     }
@@ -181,7 +337,7 @@ private:
     };
 
     class BucketTable;
-    class RecForwardingTable : public ReclaimBridge<RecForwardingTable>/*, public Stock<RecForwardingTable, 1000>*/ {
+    class RecForwardingTable : public ReclaimBridge<RecForwardingTable> {
     public:
         //friend class ConcurrentHashMap;
         BucketTable* table;
@@ -194,45 +350,182 @@ private:
         }
     };
 
-    class Node {
+    /**
+    * Values are stored in one of three layouts, picked from V at
+    * compile time:
+    *  - AtomicValue: trivially copyable V that fits a lock-free
+    *    std::atomic is stored inline.
+    *  - SeqlockValue: other trivially copyable V of up to four words
+    *    is stored inline behind a sequence lock. Writers are already
+    *    serialized by the bin lock.
+    *  - BoxedValue: anything else lives in its own heap box. Copies
+    *    of a node made by transfer/treeify share the box, and only the
+    *    node with shallow == false owns it.
+    * All of them expose the same small interface used by Node.
+    */
+    static constexpr bool INLINE_VALUE =
+            std::is_trivially_copyable<V>::value && std::is_default_constructible<V>::value;
+
+    static constexpr bool ATOMIC_VALUE =
+            INLINE_VALUE && sizeof(V) <= sizeof(void*) &&
+            std::conditional<INLINE_VALUE, std::atomic<V>, std::atomic<int>>::type::is_always_lock_free;
+
+    static constexpr bool SEQLOCK_VALUE = INLINE_VALUE && !ATOMIC_VALUE && sizeof(V) <= 4 * sizeof(uint64_t);
+
+    class BoxedValue {
+    public:
+        std::atomic<V*> box;
+
+    public:
+        explicit BoxedValue(const V& v) : box(new V(v)) {}
+
+        BoxedValue(const BoxedValue& other) : box(other.box.load()) {}
+
+        void load(V* out) const { *out = *box.load(); }
+
+        const V& view(V& /* scratch */) const { return *box.load(); }
+
+        bool equals(const V& v) const { return *box.load() == v; }
+
+        void replace(const V& v, V* old, Pin& keepPin) {
+            V* prev = box.exchange(new V(v));
+            if (old != nullptr) {
+                *old = *prev;
+            }
+            keepPin.retire<RecSingleNode<V>>(sizeof(V), prev);
+        }
+
+        void dispose() { delete box.load(); }
+    };
+
+    class AtomicValue {
+    public:
+        std::atomic<V> value;
+
+    public:
+        explicit AtomicValue(const V& v) : value(v) {}
+
+        AtomicValue(const AtomicValue& other) : value(other.value.load()) {}
+
+        void load(V* out) const { *out = value.load(); }
+
+        const V& view(V& scratch) const { return scratch = value.load(); }
+
+        bool equals(const V& v) const { return value.load() == v; }
+
+        void replace(const V& v, V* old, Pin& /* keepPin */) {
+            V prev = value.exchange(v);
+            if (old != nullptr) {
+                *old = prev;
+            }
+        }
+
+        void dispose() {}
+    };
+
+    class SeqlockValue {
+    public:
+        static const int WORDS = (sizeof(V) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        std::atomic<uint32_t> seq;
+        std::atomic<uint64_t> words[WORDS];
+
+    public:
+        explicit SeqlockValue(const V& v) : seq(0) { write(v); }
+
+        SeqlockValue(const SeqlockValue& other) : seq(0) {
+            V v;
+            other.load(&v);
+            write(v);
+        }
+
+        void load(V* out) const {
+            uint64_t buf[WORDS];
+            for (;;) {
+                uint32_t s = seq.load(std::memory_order_acquire);
+                if ((s & 1) != 0) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                for (int i = 0; i < WORDS; ++i) {
+                    buf[i] = words[i].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (seq.load(std::memory_order_relaxed) == s) {
+                    break;
+                }
+            }
+            std::memcpy(static_cast<void*>(out), buf, sizeof(V));
+        }
+
+        const V& view(V& scratch) const {
+            load(&scratch);
+            return scratch;
+        }
+
+        bool equals(const V& v) const {
+            V current;
+            load(&current);
+            return current == v;
+        }
+
+        // only called with the bin lock held, or before the node is published.
+        void replace(const V& v, V* old, Pin& /* keepPin */) {
+            V prev;
+            load(&prev);
+            write(v);
+            if (old != nullptr) {
+                *old = prev;
+            }
+        }
+
+        void dispose() {}
+
+    private:
+        void write(const V& v) {
+            uint64_t buf[WORDS] = {};
+            std::memcpy(buf, static_cast<const void*>(&v), sizeof(V));
+            uint32_t s = seq.load(std::memory_order_relaxed);
+            seq.store(s + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (int i = 0; i < WORDS; ++i) {
+                words[i].store(buf[i], std::memory_order_relaxed);
+            }
+            seq.store(s + 2, std::memory_order_release);
+        }
+    };
+
+    using NodeValue = typename std::conditional<
+            ATOMIC_VALUE, AtomicValue,
+            typename std::conditional<SEQLOCK_VALUE, SeqlockValue, BoxedValue>::type>::type;
+
+    class Node : public Stock<Node, 1024> {
     public:
         //friend class ConcurrentHashMap;
-        int hash;
+        int64_t hash;
         K key;
-        std::atomic<V*> val;
+        NodeValue val;
         std::atomic<Node*> next;
         bool shallow;
     public:
-        Node(int hash, const K& key, const V& val)
-                : hash(hash), key(key), val(new V(val)), next(nullptr), shallow(true) {}
+        Node(int64_t hash, const K& key, const V& val)
+                : hash(hash), key(key), val(val), next(nullptr), shallow(true) {}
 
-        Node(int hash, const K& key, const V& val, Node* next)
-                : hash(hash), key(key), val(new V(val)), next(next), shallow(true) {}
+        Node(int64_t hash, const K& key, const V& val, Node* next)
+                : hash(hash), key(key), val(val), next(next), shallow(true) {}
 
-        Node(int hash, const K& key, V* val)
+        Node(int64_t hash, const K& key, const NodeValue& val)
                 : hash(hash), key(key), val(val), next(nullptr), shallow(true) {}
 
-        Node(int hash, const K& key, V* val, Node* next)
+        Node(int64_t hash, const K& key, const NodeValue& val, Node* next)
                 : hash(hash), key(key), val(val), next(next), shallow(true) {}
                 
-        virtual ~Node() { //To Improve
+        // Not virtual: the kind of a node is encoded in its hash
+        // (MOVED, TREEBIN), so every delete uses the static type.
+        ~Node() {
             if (!shallow) {
-                delete val.load();
-                //delete val;
+                val.dispose();
             }
         }
-
-        virtual Node* find(int h, const K& k) {
-            // never use node's find
-            // use loop with node's next directly.
-            Node* e = this;
-            do {
-                if (e->hash == h && (e->key) == k) {
-                    return e;
-                }
-            } while ((e = e->next.load()) != nullptr);
-            return nullptr;
-        }
     };
 
     class ForwardingObject;
@@ -240,49 +533,149 @@ private:
     public:
         //friend class ConcurrentHashMap;
         std::atomic<Node*>* tableArray;
-        std::mutex* lock_levels;
-        int length;
+        int64_t length;
         std::optional<ForwardingObject> share;
 
     public:
-        BucketTable(int n)
+        BucketTable(int64_t n)
                 : tableArray(new std::atomic<Node*>[n]()),
-                  lock_levels(new std::mutex[n]()),
                   length(n),
                   share() {}
 
         ~BucketTable() {
-            for (int i = 0; i < length; ++i) {
-                Node* node = tableArray[i].load();
-                if (node == nullptr) continue;
-                if (ForwardingObject* forwardNode = dynamic_cast<ForwardingObject*>(node)) {
-                    // delete forwardNode; It's someting to do by delete share.
-                } else if (TreeBin* treeBin = dynamic_cast<TreeBin*>(node)) {
-                    TreeNode* link_start = treeBin->first;
-                    delete treeBin;
-                    Node* temp = link_start;
-                    while (temp != nullptr) {
-                        Node* next = temp->next;
-                        temp->shallow = false;
-                        delete temp;
-                        temp = next;
-                    }
-                } else {
-                    Node* temp = node;
-                    while (temp != nullptr) {
-                        Node* next = temp->next;
-                        temp->shallow = false;
-                        delete temp;
-                        temp = next;
-                    }
-                }
-            }
+            disposeBins(0, length);
 
             delete[] tableArray;
-            delete[] lock_levels;
 
             //delete share;
         }
+
+        /**
+        * Deletes the chains and trees of bins [lo, hi) and empties them.
+        * Disjoint ranges may be disposed of by different threads.
+        */
+        void disposeBins(int64_t lo, int64_t hi) {
+            for (int64_t i = lo; i < hi; ++i) {
+                disposeBin(tableArray[i].exchange(nullptr));
+            }
+        }
+
+        /**
+        * Deletes the chain or tree headed by node, which no thread can
+        * reach any more.
+        */
+        static void disposeBin(Node* node) {
+            if (node == nullptr) return;
+            if (node->hash == MOVED) {
+                // delete forwardNode; It's someting to do by delete share.
+            } else if (node->hash == TREEBIN) {
+                TreeBin* treeBin = static_cast<TreeBin*>(node);
+                TreeNode* link_start = treeBin->first;
+                delete treeBin;
+                TreeNode* temp = link_start;
+                while (temp != nullptr) {
+                    TreeNode* next = static_cast<TreeNode*>(temp->next.load());
+                    temp->shallow = false;
+                    delete temp;
+                    temp = next;
+                }
+            } else {
+                Node* temp = node;
+                while (temp != nullptr) {
+                    Node* next = temp->next;
+                    temp->shallow = false;
+                    delete temp;
+                    temp = next;
+                }
+            }
+        }
+    };
+
+    /**
+    * Runs disposeRange over [0, length) in stripes of DISPOSE_STRIDE,
+    * shared by the calling thread and (workers - 1) helpers. The helpers
+    * are fresh threads, or tasks submitted to executor when one is given;
+    * the caller always takes stripes itself, so a busy executor only makes
+    * the teardown slower, and a task the executor runs late finds nothing
+    * left to do. Returns once every stripe has been disposed of.
+    */
+    static void disposeInStripes(int64_t length, unsigned int workers, const Executor& executor,
+                                 std::function<void(int64_t, int64_t)> disposeRange) {
+        if (workers <= 1 || length <= DISPOSE_STRIDE) {
+            disposeRange(0, length);
+            return;
+        }
+
+        struct Stripes {
+            int64_t length;
+            std::function<void(int64_t, int64_t)> disposeRange;
+            std::atomic<int64_t> nextIndex;
+            std::atomic<int64_t> disposed;
+
+            Stripes(int64_t length, std::function<void(int64_t, int64_t)> disposeRange)
+                    : length(length), disposeRange(std::move(disposeRange)), nextIndex(0), disposed(0) {}
+        };
+        auto stripes = std::make_shared<Stripes>(length, std::move(disposeRange));
+        auto dispose = [stripes]() {
+            for (int64_t lo; (lo = stripes->nextIndex.fetch_add(DISPOSE_STRIDE)) < stripes->length;) {
+                stripes->disposeRange(lo, std::min(lo + DISPOSE_STRIDE, stripes->length));
+                stripes->disposed.fetch_add(DISPOSE_STRIDE);
+            }
+        };
+        std::vector<std::thread> helpers;
+        for (unsigned int i = 1; i < workers; ++i) {
+            if (executor)
+                executor(dispose);
+            else
+                helpers.emplace_back(dispose);
+        }
+        dispose();
+        for (std::thread& th : helpers) th.join();
+        // wait for the stripes other threads have claimed.
+        while (stripes->disposed.load() < stripes->length)
+            std::this_thread::yield();
+    }
+
+    /**
+    * Deletes a table that no thread can reach any more, in parallel
+    * stripes of bins when workers > 1 (see disposeInStripes).
+    */
+    static void disposeTable(BucketTable* localTable, unsigned int workers,
+                             const Executor& executor = nullptr) {
+        disposeInStripes(localTable->length, workers, executor,
+                         [localTable](int64_t lo, int64_t hi) { localTable->disposeBins(lo, hi); });
+        delete localTable;
+    }
+
+    /**
+    * The old table of a clear(): every bin forwards to the new table and
+    * the detached bin heads are kept in a compact list, so both go in a
+    * single record. Since the record is reclaimed on whatever thread
+    * unpins next, the heads are only torn down in parallel through the
+    * map's executor; without one that thread deletes them alone rather
+    * than spawning threads.
+    */
+    class RecClearedTable : public ReclaimBridge<RecClearedTable> {
+    public:
+        BucketTable* table;
+        std::vector<Node*> heads;
+        unsigned int workers;
+        Executor executor;
+
+    public:
+        RecClearedTable(BucketTable* table, std::vector<Node*>&& heads, unsigned int workers,
+                        const Executor& executor)
+                : table(table), heads(std::move(heads)), workers(workers), executor(executor) {}
+
+        void reclaim() {
+            delete table;
+            disposeInStripes(static_cast<int64_t>(heads.size()), executor ? workers : 1, executor,
+                             [this](int64_t lo, int64_t hi) {
+                                 for (int64_t i = lo; i < hi; ++i) {
+                                     BucketTable::disposeBin(heads[i]);
+                                 }
+                             });
+        }
     };
 
     class ForwardingObject : public Node {
@@ -299,11 +692,12 @@ private:
 
         ~ForwardingObject() {}
 
-        Node* find(int h, const K& k) {
+        template <typename Q>
+        Node* find(int64_t h, const Q& k) {
             // loop to avoid arbitrarily deep recursion on forwarding nodes
             for (BucketTable* localTable = nextTable;;) {
                 Node* e;
-                int n, eh;
+                int64_t n, eh;
                 std::atomic<Node*>* tab;
                 tab = localTable->tableArray;
                 n = localTable->length;
@@ -312,16 +706,16 @@ private:
                     return nullptr;
 
                 if ((eh = e->hash) < 0) {
-                    if (ForwardingObject* fe = (dynamic_cast<ForwardingObject*>(e))) {
-                        localTable = fe->nextTable;
+                    if (eh == MOVED) {
+                        localTable = static_cast<ForwardingObject*>(e)->nextTable;
                         continue;
                     } else {
-                        return e->find(h, k);
+                        return findSpecial(e, h, k);
                     }
                 }
 
                 for (;;) {
-                    if (eh == h && KeyEqual()(e->key, k)) {
+                    if ((eh = e->hash) == h && KeyEqual()(e->key, k)) {
                         return e;
                     }
 
@@ -343,7 +737,7 @@ private:
         std::atomic<bool> red;
 
     public:
-        TreeNode(int hash, const K& key, const V& val, Node* next, TreeNode* parent)
+        TreeNode(int64_t hash, const K& key, const V& val, Node* next, TreeNode* parent)
                 : Node(hash, key, val, next),
                   parent(parent),
                   left(nullptr),
@@ -351,7 +745,7 @@ private:
                   prev(nullptr),
                   red(false) {}
         
-        TreeNode(int hash, const K& key, V* val, Node* next, TreeNode* parent)
+        TreeNode(int64_t hash, const K& key, const NodeValue& val, Node* next, TreeNode* parent)
                 : Node(hash, key, val, next),
                   parent(parent),
                   left(nullptr),
@@ -359,49 +753,66 @@ private:
                   prev(nullptr),
                   red(false) {}
 
-        Node* find(int h, const K& k) {
-            // never use find
-            // use findTreeNode directly in TreeBin
-            return findTreeNode(h, k); 
-        }
-
         /**
         * Returns the TreeNode (or nullptr if not found) for the given key
-        * starting at given root->
+        * starting at given root. A reader that does not hold the bin
+        * lock passes its TreeBin's version as read before the search;
+        * the search gives up (returning nullptr) once it sees the version
+        * move, since a tree under restructuring may briefly hold cycles.
         */
-        TreeNode* findTreeNode(size_t h, const K& k) {
+        template <typename Q>
+        TreeNode* findTreeNode(int64_t h, const Q& k, const std::atomic<uint64_t>* version = nullptr,
+                               uint64_t expected = 0) {
+            // left subtrees still to be searched once the right one is
+            // exhausted; only recurse if a degenerate tree overflows it.
+            TreeNode* pending[FIND_STACK_DEPTH];
+            int top = 0;
+            unsigned int steps = 0;
             TreeNode* p = this;
-            do {
-                size_t ph;
-                // K* pk;
-                TreeNode* pl = p->left;
-                TreeNode* pr = p->right;
-                TreeNode* q = nullptr;
-                if ((ph = p->hash) > h)
-                    p = pl;
-                else if (ph < h)
-                    p = pr;
-                else if (KeyEqual()(p->key, k)) {
-                    return p;
-                } else if (pl == nullptr)
-                    p = pr;
-                else if (pr == nullptr)
-                    p = pl;
-                else if ((q = pr->findTreeNode(h, k)) != nullptr)
-                    return q;
-                else
-                    p = pl;
-            } while (p != nullptr);
-            return nullptr;
+            for (;;) {
+                while (p != nullptr) {
+                    if (version != nullptr && (++steps % VALIDATE_STEPS) == 0 && version->load() != expected)
+                        return nullptr;
+                    int64_t ph;
+                    // K* pk;
+                    TreeNode* pl = p->left;
+                    TreeNode* pr = p->right;
+                    TreeNode* q = nullptr;
+                    int dir;
+                    if ((ph = p->hash) > h)
+                        p = pl;
+                    else if (ph < h)
+                        p = pr;
+                    else if (KeyEqual()(p->key, k)) {
+                        return p;
+                    } else if (pl == nullptr)
+                        p = pr;
+                    else if (pr == nullptr)
+                        p = pl;
+                    else if ((dir = compareKeys(k, p->key)) != 0)
+                        p = (dir < 0) ? pl : pr;
+                    else if (top < FIND_STACK_DEPTH) {
+                        pending[top++] = pl;
+                        p = pr;
+                    } else if ((q = pr->findTreeNode(h, k, version, expected)) != nullptr)
+                        return q;
+                    else
+                        p = pl;
+                }
+                if (top == 0) return nullptr;
+                p = pending[--top];
+            }
         }
     };
 
     /**
     * TreeNodes used at the heads of bins. TreeBins do not hold user
     * keys or values, but instead point to list of TreeNodes and
-    * their root. They also maintain a parasitic read-write lock
-    * forcing writers (who hold bin lock) to wait for readers (who do
-    * not) to complete before tree restructuring operations.
+    * their root. They also maintain a sequence number that writers
+    * (who hold bin lock) make odd around tree restructuring
+    * operations. Readers (who do not) search the tree optimistically
+    * and retry if the sequence moved, so neither side ever waits for
+    * the other, and removed nodes stay readable until SEBR frees them.
     */
 
     class TreeBin : public Node {
@@ -409,13 +820,10 @@ private:
         //friend class ConcurrentHashMap;
         std::atomic<TreeNode*> root;
         std::atomic<TreeNode*> first;
-        std::atomic<Blocking*> waiter;
-        std::atomic<int> lockState;
+        std::atomic<uint64_t> version; // odd while the tree is being restructured
 
-        // values for lockState
-        static const int WRITER = 1; // set while holding write lock
-        static const int WAITER = 2; // set when waiting for write lock
-        static const int READER = 4; // increment value for setting read lock
+        // failed optimistic reads before a reader starts yielding
+        static const int READ_SPINS = 64;
 
     public:
         /**
@@ -425,8 +833,7 @@ private:
                 : Node(TREEBIN, K(), V()),
                   root(nullptr),
                   first(nullptr),
-                  waiter(nullptr),
-                  lockState(0) {
+                  version(0) {
             this->shallow = false;
             this->first = b;
             TreeNode* r = nullptr;
@@ -440,15 +847,16 @@ private:
                     x->red = false;
                     r = x;
                 } else {
-                    int h = x->hash;
+                    int64_t h = x->hash;
                     for (TreeNode* p = r;;) {
-                        int dir, ph;
+                        int dir;
+                        int64_t ph;
                         if ((ph = p->hash) > h)
                             dir = -1;
                         else if (ph < h)
                             dir = 1;
                         else
-                            dir = 0;
+                            dir = compareKeys(x->key, p->key);
 
                         TreeNode* xp = p;
                         if ((p = (dir <= 0) ? p->left : p->right) == nullptr) {
@@ -464,79 +872,40 @@ private:
                 }
             }
             this->root = r;
-            bool res = checkInvariants(root);
-            assert(res);
+            assert(checkInvariants(root));
         }
 
         /**
-        * Returns matching node or nullptr if none-> Tries to search
-        * using tree comparisons from root, but continues linear
-        * search when lock not available->
+        * Returns matching node or nullptr if none. Searches the tree
+        * from root, and retries whenever a writer restructured it
+        * meanwhile (spinning, then yielding while one is in progress).
         */
-        Node* find(int h, const K& k) {
-            for (Node* e = first; e != nullptr;) {
-                int s;
-                // const K* ek;
-                if (((s = lockState.load()) & (WAITER | WRITER)) != 0) {
-                    if (e->hash == h && (KeyEqual()(e->key, k))) {
-                        return e;
-                    }
-                    e = e->next;
-                } else if (lockState.compare_exchange_strong(s, s + READER)) {
-                    TreeNode* r;
-                    TreeNode* p;
-                    p = ((r = root) == nullptr ? nullptr : r->findTreeNode(h, k));
-                    Blocking* w;
-                    if (lockState.fetch_add(-READER) == (READER | WAITER) &&
-                        (w = waiter.load()) != nullptr) {
-                        w->unpark();
-                    }
-                    return p;
+        template <typename Q>
+        Node* find(int64_t h, const Q& k) {
+            for (int spins = 0;;) {
+                uint64_t v = version.load();
+                if ((v & 1) == 0) {
+                    TreeNode* r = root.load();
+                    TreeNode* p = (r == nullptr) ? nullptr : r->findTreeNode(h, k, &version, v);
+                    if (version.load() == v) return p;
                 }
+                if (++spins >= READ_SPINS) std::this_thread::yield();
             }
-            return nullptr;
         }
 
         /**
-        * Acquires write lock for tree restructuring.
+        * Marks the start of tree restructuring. Writers are already
+        * serialized by the bin lock.
         */
-        void lockRoot(Pin& keepPin) {
-            int s = 0;
-            if (!lockState.compare_exchange_strong(s, WRITER))
-                contendedLock(keepPin); // offload to separate method
-        }
-
-        void unlockRoot() { lockState.store(0); }
-
-        void contendedLock(Pin& keepPin) {
-            // contend locks
-            bool waiting = false;
-            Blocking* block = nullptr;
-            for (int s;;) {
-                if (((s = lockState.load()) & ~WAITER) == 0) {
-                    if (lockState.compare_exchange_strong(s, WRITER)) {
-                        if (waiting) {
-                            waiter.store(nullptr);
-                            keepPin.retire<RecSingleNode<Blocking>> (sizeof(Blocking), block);
-                        }
-                        return;
-                    }
-                } else if ((s & WAITER) == 0) {
-                    if (lockState.compare_exchange_strong(s, s | WAITER)) {
-                        block = new Blocking();
-                        waiting = true;
-                        waiter.store(block);
-                    }
-                } else if (waiting) {
-                    block->park();
-                }
-            }
-        }
+        void lockRoot() { version.fetch_add(1); }
+
+        void unlockRoot() { version.fetch_add(1); }
 
-        Node* putTreeVal(int h, const K& k, const V& v, Pin& keepPin) {
+        Node* putTreeVal(int64_t h, const K& k, const V& v) {
             bool searched = false;
             for (TreeNode* p = root;;) {
-                int dir, ph;
+                int dir;
+                int64_t ph;
                 // K* pk;
                 if (p == nullptr) {
                     first = root = new TreeNode(h, k, v, nullptr, nullptr);
@@ -547,7 +916,8 @@ private:
                     dir = 1;
                 else if (KeyEqual()(p->key, k))
                     return p;
-                else {
+                else if ((dir = compareKeys(k, p->key)) == 0) {
+                    // unordered: the key may sit in either subtree.
                     if (!searched) {
                         TreeNode* q;
                         TreeNode* ch;
@@ -573,15 +943,14 @@ private:
                     if (!xp->red)
                         x->red = true;
                     else {
-                        lockRoot(keepPin);
+                        lockRoot();
                         root = balanceInsertion(root, x);
                         unlockRoot();
                     }
                     break;
                 }
             }
-            bool res = checkInvariants(root);
-            assert(res);
+            assert(checkInvariants(root));
             return nullptr;
         }
 
@@ -827,7 +1196,7 @@ private:
                 (rl = r->left) == nullptr || rl->left == nullptr)
                 return flagAndRecTreeNode(true, p, keepPin, delayDispose);
 
-            lockRoot(keepPin);
+            lockRoot();
             TreeNode* replacement;
             TreeNode* pl = p->left;
             TreeNode* pr = p->right;
@@ -898,37 +1267,53 @@ private:
                 }
             }
             unlockRoot();
-            bool res = checkInvariants(root);
-            assert(res);
+            assert(checkInvariants(root));
             return flagAndRecTreeNode(false, p, keepPin, delayDispose);
         }
     };
 
-    static int spread(int h) {
-        // unsigned int v = static_cast<unsigned int> (h);
-        return (h ^ (static_cast<unsigned int>(h) >> 16)) & HASH_BITS;
+    /**
+    * Looks up k in a bin whose head has a negative (tag) hash,
+    * dispatching on the tag instead of RTTI.
+    */
+    template <typename Q>
+    static Node* findSpecial(Node* e, int64_t h, const Q& k) {
+        switch (e->hash) {
+            case MOVED:
+                return static_cast<ForwardingObject*>(e)->find(h, k);
+            case TREEBIN:
+                return static_cast<TreeBin*>(e)->find(h, k);
+            default:
+                return nullptr;
+        }
+    }
+
+    static int64_t spread(size_t h) {
+        // fold the upper bits down, small tables only index with the low ones.
+        h ^= h >> 32;
+        return static_cast<int64_t>(h ^ (h >> 16)) & HASH_BITS;
     }
 
-    static Node* tabAt(std::atomic<Node*>* tab, int i) { return tab[i].load(); }
+    static Node* tabAt(std::atomic<Node*>* tab, int64_t i) { return tab[i].load(); }
 
-    static bool casTabAt(std::atomic<Node*>* tab, int i, Node*& old, Node* newNode) {
+    static bool casTabAt(std::atomic<Node*>* tab, int64_t i, Node*& old, Node* newNode) {
         return tab[i].compare_exchange_strong(old, newNode);
     }
 
-    static void setTabAt(std::atomic<Node*>* tab, int i, Node* node) { tab[i].store(node); }
+    static void setTabAt(std::atomic<Node*>* tab, int64_t i, Node* node) { tab[i].store(node); }
 
     BucketTable* initTable() {
         BucketTable* localTable;
-        int sc;
+        int64_t sc;
         while (((localTable = table.load()) == nullptr) || localTable->length == 0) {
             if ((sc = sizeCtl.load()) < 0)
                 std::this_thread::yield();
             else if (sizeCtl.compare_exchange_strong(sc, -1)) {
                 if ((localTable = table.load()) == nullptr || localTable->length == 0) {
-                    int n = (sc > 0) ? sc : DEFAULT_CAPACITY;
+                    int64_t n = (sc > 0) ? sc : DEFAULT_CAPACITY;
                     BucketTable* nt = new BucketTable(n);
                     table.store(localTable = nt);
-                    sc = n - (static_cast<unsigned int>(n) >> 2);
+                    sc = n - (static_cast<uint64_t>(n) >> 2);
                     //sizeCtl.store(sc);
                 }
                 sizeCtl.store(sc);
@@ -938,36 +1323,41 @@ private:
         return localTable;
     }
 
-    static int numberOfLeadingZeros(int i) {
+    static int numberOfLeadingZeros(int64_t i) {
         // HD, Figure 5-6
-        if (i == 0) return 32;
+        if (i == 0) return 64;
         int n = 1;
-        if (static_cast<unsigned int>(i) >> 16 == 0) {
+        uint64_t x = static_cast<uint64_t>(i);
+        if (x >> 32 == 0) {
+            n += 32;
+            x <<= 32;
+        }
+        if (x >> 48 == 0) {
             n += 16;
-            i <<= 16;
+            x <<= 16;
         }
-        if (static_cast<unsigned int>(i) >> 24 == 0) {
+        if (x >> 56 == 0) {
             n += 8;
-            i <<= 8;
+            x <<= 8;
         }
-        if (static_cast<unsigned int>(i) >> 28 == 0) {
+        if (x >> 60 == 0) {
             n += 4;
-            i <<= 4;
+            x <<= 4;
         }
-        if (static_cast<unsigned int>(i) >> 30 == 0) {
+        if (x >> 62 == 0) {
             n += 2;
-            i <<= 2;
+            x <<= 2;
         }
-        n -= static_cast<unsigned int>(i) >> 31;
+        n -= static_cast<int>(x >> 63);
         return n;
     }
 
-    static int resizeStamp(int n) {
-        return numberOfLeadingZeros(n) | (1 << (RESIZE_STAMP_BITS - 1));
+    static int64_t resizeStamp(int64_t n) {
+        return numberOfLeadingZeros(n) | (1LL << (RESIZE_STAMP_BITS - 1));
     }
 
     void transfer(BucketTable* localTable, Pin& keepPin) {
-        int len = localTable->length;
+        int64_t len = localTable->length;
 
         BucketTable* nt = new BucketTable(len << 1);
         localTable->share.emplace(nt);
@@ -983,21 +1373,21 @@ private:
     */
     void transfer(BucketTable* localTable, BucketTable* nextTab, Pin& keepPin) {
         std::atomic<Node*>* tab = localTable->tableArray;
-        int len = localTable->length, stride;
-        if ((stride = (NCPU > 1) ? (static_cast<unsigned int>(len) >> 3) / NCPU : len) <
+        int64_t len = localTable->length, stride;
+        if ((stride = (NCPU > 1) ? (static_cast<uint64_t>(len) >> 3) / NCPU : len) <
             MIN_TRANSFER_STRIDE)
             stride = MIN_TRANSFER_STRIDE; // subdivide range
 
-        int nextn = nextTab->length;
+        int64_t nextn = nextTab->length;
         //ForwardingObject* fwd = new ForwardingObject(nextTab);
         bool advance = true;
         bool finishing = false; // to ensure sweep before committing nextTab
 
-        for (int i = 0, bound = 0;;) {
+        for (int64_t i = 0, bound = 0;;) {
             Node* f;
-            int fh;
+            int64_t fh;
             while (advance) {
-                int nextIndex, nextBound;
+                int64_t nextIndex, nextBound;
                 if (--i >= bound || finishing)
                     advance = false;
                 else if ((nextIndex = transferIndex.load()) <= 0) {
@@ -1012,16 +1402,15 @@ private:
                 }
             }
             if (i < 0 || i >= len || i + len >= nextn) {
-                int sc;
+                int64_t sc;
                 if (finishing) {
                     nextTable.store(nullptr);
                     table.store(nextTab);
 
                     keepPin.retire<RecForwardingTable>(sizeof(BucketTable) + sizeof(ForwardingObject) +
-                                    localTable->length *
-                                            (sizeof(std::mutex) + sizeof(std::atomic<Node*>)), localTable);
+                                    localTable->length * sizeof(std::atomic<Node*>), localTable);
 
-                    sizeCtl.store((len << 1) - (static_cast<unsigned int>(len) >> 1));
+                    sizeCtl.store((len << 1) - (static_cast<uint64_t>(len) >> 1));
                     return;
                 }
                 sc = sizeCtl.load();
@@ -1037,17 +1426,16 @@ private:
                 advance = true; // already processed
             } else {
                 DelayDispose delayDispose;
-                std::lock_guard<std::mutex> control(
-                        localTable->lock_levels[i]); //std::cout << "KKKK" << std::endl;
+                std::lock_guard<std::mutex> control(binLock(i)); //std::cout << "KKKK" << std::endl;
                 if (tabAt(tab, i) == f) {
                     Node* ln = nullptr; //std::cout << "JJJJJ" << std::endl;
                     Node* hn = nullptr;
                     // ForwardingObject* fwd = nullptr;
                     if (fh >= 0) {
-                        int runBit = fh & len;
+                        int64_t runBit = fh & len;
                         Node* lastRun = f;
                         for (Node* p = f->next.load(); p != nullptr; p = p->next.load()) {
-                            int b = p->hash & len;
+                            int64_t b = p->hash & len;
                             if (b != runBit) {
                                 runBit = b;
                                 lastRun = p;
@@ -1063,9 +1451,9 @@ private:
                         int bytes_linkn = 0;
                         for (Node* p = f; p != lastRun; p = p->next.load()) {
                             ++bytes_linkn;
-                            int ph = p->hash;
+                            int64_t ph = p->hash;
                             const K& pk = p->key;
-                            V* pv = p->val.load();
+                            const NodeValue& pv = p->val;
                             if ((ph & len) == 0) {
                                 ln = new Node(ph, pk, pv, ln);
                             } else {
@@ -1073,7 +1461,7 @@ private:
                             }
                         }
 
-                        assert(!(dynamic_cast<ForwardingObject*>(f)));
+                        assert(f->hash >= 0);
 
                         setTabAt(nextTab->tableArray, i, ln);
                         setTabAt(nextTab->tableArray, i + len, hn);
@@ -1082,16 +1470,16 @@ private:
                         delayDispose.ptr = [=, &keepPin]() -> void {
                             keepPin.retire<RecLinkedNode>(bytes_linkn * sizeof(Node), f, lastRun);
                         };
-                    } else if (TreeBin* tb = dynamic_cast<TreeBin*>(f)) {
-                        TreeBin* t = tb;
+                    } else if (fh == TREEBIN) {
+                        TreeBin* t = static_cast<TreeBin*>(f);
                         TreeNode* lo = nullptr;
                         TreeNode* loTail = nullptr;
                         TreeNode* hi = nullptr;
                         TreeNode* hiTail = nullptr;
                         int lc = 0, hc = 0;
                         for (Node* e = t->first; e != nullptr; e = e->next) {
-                            int h = e->hash;
-                            TreeNode* p = new TreeNode(h, e->key, e->val.load(), nullptr, nullptr);
+                            int64_t h = e->hash;
+                            TreeNode* p = new TreeNode(h, e->key, e->val, nullptr, nullptr);
                             if ((h & len) == 0) {
                                 if ((p->prev = loTail) == nullptr)
                                     lo = p;
@@ -1155,8 +1543,9 @@ private:
         }
     }
 
-    static int tableSizeFor(int c) {
-        int n = static_cast<unsigned int>(-1) >> numberOfLeadingZeros(c - 1);
+    static int64_t tableSizeFor(int64_t c) {
+        if (c <= 1) return 1;
+        int64_t n = static_cast<uint64_t>(-1) >> numberOfLeadingZeros(c - 1);
         return (n < 0) ? 1 : (n >= MAXIMUM_CAPACITY) ? MAXIMUM_CAPACITY : n + 1;
     }
 
@@ -1165,19 +1554,19 @@ private:
     *
     * @param size number of elements (doesn't need to be perfectly accurate)
     */
-    void tryPresize(int size, Pin& keepPin) {
-        int c = (size >= (int)(static_cast<unsigned int>(MAXIMUM_CAPACITY) >> 1))
+    void tryPresize(int64_t size, Pin& keepPin) {
+        int64_t c = (size >= (MAXIMUM_CAPACITY >> 1))
                         ? MAXIMUM_CAPACITY
-                        : tableSizeFor(size + (static_cast<unsigned int>(size) >> 1) + 1);
-        int sc;
+                        : tableSizeFor(size + (static_cast<uint64_t>(size) >> 1) + 1);
+        int64_t sc;
         while ((sc = sizeCtl.load()) >= 0) {
             BucketTable* localTable = table.load();
-            int n = localTable->length;
+            int64_t n = localTable->length;
             
             if (c <= sc || n >= MAXIMUM_CAPACITY)
                 break;
             else if (localTable == table.load()) {
-                int rs = resizeStamp(n);
+                int64_t rs = resizeStamp(n);
                 if (sizeCtl.compare_exchange_strong(sc, (rs << RESIZE_STAMP_SHIFT) + 2))
                     transfer(localTable, keepPin);
             }
@@ -1188,21 +1577,21 @@ private:
     * Replaces all linked nodes in bin at given index unless table is
     * too small, in which case resizes instead.
     */
-    void treeifyBin(BucketTable* localTable, int index, Pin& keepPin) {
+    void treeifyBin(BucketTable* localTable, int64_t index, Pin& keepPin) {
         Node* b;
-        int n;
+        int64_t n;
         if (localTable != nullptr) {
             if ((n = localTable->length) < MIN_TREEIFY_CAPACITY)
                 tryPresize(n << 1, keepPin);
             else if ((b = tabAt(localTable->tableArray, index)) != nullptr && b->hash >= 0) {
-                std::lock_guard<std::mutex> control(localTable->lock_levels[index]);
+                std::lock_guard<std::mutex> control(binLock(index));
                 if (tabAt(localTable->tableArray, index) == b) {
                     TreeNode* hd = nullptr;
                     TreeNode* tl = nullptr;
                     int num = 0;
                     for (Node* e = b; e != nullptr; e = e->next.load()) {
                         ++num;
-                        TreeNode* p = new TreeNode(e->hash, e->key, e->val.load(), nullptr, nullptr);
+                        TreeNode* p = new TreeNode(e->hash, e->key, e->val, nullptr, nullptr);
                         if ((p->prev = tl) == nullptr)
                             hd = p;
                         else
@@ -1237,18 +1626,149 @@ private:
         return hd;
     }
 
+    static int& probe() {
+        thread_local int h = 0;
+        return h;
+    }
+
+    /**
+    * Returns the probe value for the current thread, initializing it
+    * on first use. Never returns zero.
+    */
+    static int getProbe() {
+        static std::atomic<unsigned int> probeGenerator(0);
+        int& h = probe();
+        if (h == 0) {
+            unsigned int p = probeGenerator.fetch_add(PROBE_INCREMENT) + PROBE_INCREMENT;
+            h = (p == 0) ? 1 : static_cast<int>(p);
+        }
+        return h;
+    }
+
+    /**
+    * Pseudo-randomly advances and records the given probe value for
+    * the current thread (xorshift).
+    */
+    static int advanceProbe(int h) {
+        unsigned int p = static_cast<unsigned int>(h);
+        p ^= p << 13;
+        p ^= p >> 17;
+        p ^= p << 5;
+        return probe() = static_cast<int>(p);
+    }
+
+    long sumCount() {
+        CounterCellTable* as = counterCells.load();
+        long sum = baseCount.load();
+        if (as != nullptr) {
+            for (int i = 0; i < as->length; ++i) {
+                CounterCell* a;
+                if ((a = as->cells[i].load()) != nullptr) sum += a->value.load();
+            }
+        }
+        return sum;
+    }
+
+    /**
+    * Slow path of addCount, see LongAdder version for explanation.
+    * Cells are created or the table doubled only after a CAS on an
+    * existing cell failed, and the table never grows beyond NCPU.
+    */
+    void fullAddCount(long x, bool wasUncontended, Pin& keepPin) {
+        int h = getProbe();
+        bool collide = false; // True if last slot nonempty
+        for (;;) {
+            CounterCellTable* as;
+            CounterCell* a;
+            int n, busy;
+            long v;
+            if ((as = counterCells.load()) != nullptr && (n = as->length) > 0) {
+                if ((a = as->cells[(n - 1) & h].load()) == nullptr) {
+                    if (cellsBusy.load() == 0) { // Try to attach new Cell
+                        CounterCell* r = new CounterCell(x); // Optimistic create
+                        if (cellsBusy.compare_exchange_strong(busy = 0, 1)) {
+                            bool created = false;
+                            CounterCellTable* rs;
+                            int m, j;
+                            // Recheck under lock
+                            if ((rs = counterCells.load()) != nullptr && (m = rs->length) > 0 &&
+                                rs->cells[j = (m - 1) & h].load() == nullptr) {
+                                rs->cells[j].store(r);
+                                created = true;
+                            }
+                            cellsBusy.store(0);
+                            if (created) break;
+                            delete r;
+                            continue; // Slot is now non-empty
+                        }
+                        delete r;
+                    }
+                    collide = false;
+                } else if (!wasUncontended) // CAS already known to fail
+                    wasUncontended = true;  // Continue after rehash
+                else if (v = a->value.load(), a->value.compare_exchange_strong(v, v + x))
+                    break;
+                else if (counterCells.load() != as || n >= static_cast<int>(NCPU))
+                    collide = false; // At max size or stale
+                else if (!collide)
+                    collide = true;
+                else if (cellsBusy.load() == 0 && cellsBusy.compare_exchange_strong(busy = 0, 1)) {
+                    if (counterCells.load() == as) { // Expand table unless stale
+                        CounterCellTable* rs = new CounterCellTable(n << 1);
+                        for (int i = 0; i < n; ++i) rs->cells[i].store(as->cells[i].load());
+                        counterCells.store(rs);
+                        keepPin.retire<RecSingleNode<CounterCellTable>>(
+                                sizeof(CounterCellTable) + n * sizeof(std::atomic<CounterCell*>), as);
+                    }
+                    cellsBusy.store(0);
+                    collide = false;
+                    continue; // Retry with expanded table
+                }
+                h = advanceProbe(h);
+            } else if (cellsBusy.load() == 0 && counterCells.load() == as &&
+                       cellsBusy.compare_exchange_strong(busy = 0, 1)) {
+                bool init = false;
+                if (counterCells.load() == as) { // Initialize table
+                    CounterCellTable* rs = new CounterCellTable(2);
+                    rs->cells[h & 1].store(new CounterCell(x));
+                    counterCells.store(rs);
+                    init = true;
+                }
+                cellsBusy.store(0);
+                if (init) break;
+            } else if (v = baseCount.load(), baseCount.compare_exchange_strong(v, v + x))
+                break; // Fall back on using base
+        }
+    }
+
     void addCount(long x, int check, Pin& keepPin) {
         // nums(key/value) in map.
-        long s = baseCount.fetch_add(x) + x;
+        CounterCellTable* as;
+        long b = baseCount.load();
+        long s = b + x;
+        if ((as = counterCells.load()) != nullptr || !baseCount.compare_exchange_strong(b, s)) {
+            CounterCell* a;
+            long v;
+            int m;
+            bool uncontended = true;
+            if (as == nullptr || (m = as->length - 1) < 0 ||
+                (a = as->cells[getProbe() & m].load()) == nullptr ||
+                !(uncontended = (v = a->value.load(), a->value.compare_exchange_strong(v, v + x)))) {
+                fullAddCount(x, uncontended, keepPin);
+                return;
+            }
+            if (check <= 1) return;
+            s = sumCount();
+        }
 
         // check for resize.
         if (check >= 0) {
             BucketTable* localTable;
             BucketTable* nt;
-            int n, sc;
+            int64_t n, sc;
             while (s >= (long)(sc = sizeCtl.load()) &&
                    (n = (localTable = table.load())->length) < MAXIMUM_CAPACITY) {
-                int rs = resizeStamp(n) << RESIZE_STAMP_SHIFT;
+                int64_t rs = resizeStamp(n) << RESIZE_STAMP_SHIFT;
 
                 if (sc < 0) {
                     if (sc == rs + MAX_RESIZERS || sc == rs + 1 ||
@@ -1260,7 +1780,7 @@ private:
                 } else if (sizeCtl.compare_exchange_strong(sc, rs + 2)) {
                     transfer(localTable, keepPin);
                 }
-                s = baseCount.load();
+                s = sumCount();
             }
         }
     }
@@ -1270,11 +1790,11 @@ private:
     */
     BucketTable* helpTransfer(BucketTable* localTable, Node* f, Pin& keepPin) {
         BucketTable* nextTab;
-        int sc;
+        int64_t sc;
         ForwardingObject* ff;
-        ff = dynamic_cast<ForwardingObject*>(f);
+        ff = static_cast<ForwardingObject*>(f);
         nextTab = ff->nextTable;
-        int rs = resizeStamp(localTable->length) << RESIZE_STAMP_SHIFT;
+        int64_t rs = resizeStamp(localTable->length) << RESIZE_STAMP_SHIFT;
         while (nextTab == nextTable.load() && table.load() == localTable &&
                (sc = sizeCtl.load()) < 0) {
             if (sc == rs + MAX_RESIZERS || sc == rs + 1 || transferIndex.load() <= 0) break;
@@ -1290,26 +1810,58 @@ private:
     std::atomic<BucketTable*> table;
     std::atomic<BucketTable*> nextTable;
     std::atomic<long> baseCount;
-    std::atomic<int> sizeCtl;
-    std::atomic<int> transferIndex;
+    std::atomic<int> cellsBusy;
+    std::atomic<CounterCellTable*> counterCells;
+    std::atomic<int64_t> sizeCtl;
+    std::atomic<int64_t> transferIndex;
+    LockStripes lockStripes;
+
+    unsigned int disposeWorkers;
+    Executor disposeExecutor;
+
+    std::mutex& binLock(int64_t i) { return lockStripes.at(i); }
 
 public:
-    ConcurrentHashMap()
-            : ConcurrentBridge<ConcurrentHashMap<K, V>>(),
+    ConcurrentHashMap() : ConcurrentHashMap(0) {}
+
+    /**
+    * Creates a new, empty map whose operations each free at most
+    * bytesReclaimBudget bytes of retired memory when they unpin (0 for
+    * no limit), leaving the rest to the operations that follow. The
+    * budget is ignored under reclaim_in_background(), where operations
+    * free nothing themselves.
+    */
+    explicit ConcurrentHashMap(int32_t bytesReclaimBudget)
+            : Bridge(Bridge::DEFAULT_GC_THRESHOLD, Bridge::DEFAULT_EPOCH_THRESHOLD,
+                     bytesReclaimBudget),
               table(nullptr),
               nextTable(nullptr),
               baseCount(0),
+              cellsBusy(0),
+              counterCells(nullptr),
               sizeCtl(0),
-              transferIndex(0) {
+              transferIndex(0),
+              lockStripes(std::min<int64_t>(tableSizeFor(std::max(1U, NCPU) * LOCK_STRIPES_PER_CPU),
+                                            MAX_LOCK_STRIPES)),
+              disposeWorkers(1),
+              disposeExecutor(nullptr) {
         initTable();
     }
 
     ~ConcurrentHashMap() {
-        delete table.load();
+        disposeTable(table.load(), disposeWorkers, disposeExecutor);
+
+        CounterCellTable* as = counterCells.load();
+        if (as != nullptr) {
+            for (int i = 0; i < as->length; ++i) {
+                delete as->cells[i].load();
+            }
+            delete as;
+        }
     }
 
     bool empty() {
-        return baseCount.load() == 0;
+        return size() == 0;
     }
 
     long max_size() {
@@ -1317,7 +1869,73 @@ public:
     }
     
     long size() {
-        return baseCount.load();
+        Pin keepPin(this);
+        return sumCount();
+    }
+
+    /**
+    * Makes the destructor tear the table down on workers threads in
+    * stripes of bins instead of walking it alone. With an executor the
+    * (workers - 1) helpers are submitted to it rather than spawned.
+    *
+    * @param workers  number of threads deleting entries, the caller included
+    * @param executor optional runner for the helper tasks
+    */
+    void set_dispose_workers(unsigned int workers, Executor executor = nullptr) {
+        disposeWorkers = workers;
+        disposeExecutor = std::move(executor);
+    }
+
+    /**
+    * Removes all of the mappings from this map.
+    *
+    * Every bin of the current table is detached under its lock and
+    * replaced with the table's forwarding node, so concurrent readers
+    * and writers move on to a fresh empty table. The old table and the
+    * detached chains are then retired as one record; with workers > 1
+    * and an executor set by set_dispose_workers, the chains are deleted
+    * by that many tasks in parallel stripes when the record is reclaimed.
+    *
+    * @param workers number of tasks tearing down the old entries
+    */
+    void clear(unsigned int workers = 1) {
+        Pin keepPin(this);
+        int64_t sc;
+        // own sizeCtl like initTable does, waiting out any resize.
+        while ((sc = sizeCtl.load()) < 0 || !sizeCtl.compare_exchange_strong(sc, -1))
+            std::this_thread::yield();
+
+        BucketTable* localTable = table.load();
+        std::atomic<Node*>* tab = localTable->tableArray;
+        int64_t n = localTable->length;
+        BucketTable* nt = new BucketTable(DEFAULT_CAPACITY);
+        std::vector<Node*> heads;
+        ForwardingObject* fwd = &localTable->share.emplace(nt);
+        long removed = 0;
+
+        for (int64_t i = 0; i < n; ++i) {
+            Node* f = nullptr;
+            if (casTabAt(tab, i, f, fwd)) continue;
+
+            std::lock_guard<std::mutex> control(binLock(i));
+            f = tabAt(tab, i);
+            setTabAt(tab, i, fwd);
+            // emptied by an erase since the failed cas.
+            if (f == nullptr) continue;
+            heads.push_back(f);
+            for (Node* e = (f->hash == TREEBIN) ? static_cast<TreeBin*>(f)->first : f; e != nullptr;
+                 e = e->next.load()) {
+                ++removed;
+            }
+        }
+
+        table.store(nt);
+        addCount(-removed, -1, keepPin);
+        keepPin.retire<RecClearedTable>(sizeof(BucketTable) + n * sizeof(std::atomic<Node*>) +
+                                        heads.size() * sizeof(Node*) + sizeof(ForwardingObject) +
+                                        removed * sizeof(Node),
+                                        localTable, std::move(heads), workers, disposeExecutor);
+        sizeCtl.store(DEFAULT_CAPACITY - (static_cast<uint64_t>(DEFAULT_CAPACITY) >> 2));
     }
 
     class ConstKeyValueIterator {
@@ -1339,7 +1957,7 @@ public:
         }
 
         const V& val() {
-            return *curr->val.load();
+            return curr->val.view(scratch);
         }
 
         const bool is_data() {
@@ -1349,6 +1967,7 @@ public:
     private:
         std::optional<Pin> keepPin;
         Node* curr;
+        V scratch;
     };
 
     class ConstIterator {
@@ -1422,14 +2041,15 @@ public:
         }
 
         const V& val() {
-            return *curr->val.load();
+            return curr->val.view(scratch);
         }
 
     private:
         std::optional<Pin> keepPin;
         const BucketTable* table;
         Node* curr;
-        int index;
+        int64_t index;
+        V scratch;
     };
 
     ConstIterator begin() {
@@ -1440,113 +2060,253 @@ public:
         return ConstIterator();
     }
 
-    bool find(const K& key, V* value) {
-        BucketTable* localTable;
-        std::atomic<Node*>* tab;
-        Node* e;
-        int n, eh;
-        int h = spread(Hash()(key));
-        Pin keepPin(this);
+    bool find(const K& key, V* value) { return findValue(key, value); }
 
-        localTable = table.load();
-        tab = localTable->tableArray;
-        n = localTable->length;
-        if ((e = tabAt(tab, (n - 1) & h)) == nullptr) return false;
+    ConstKeyValueIterator find_reference(const K& key) { return findReference(key); }
 
-        if ((eh = e->hash) == h) {
-            if (KeyEqual()(e->key, key)) {
-                *value = *e->val.load();
-                return true;
-            }
-        } else if (eh < 0) {
-            Node* result = e->find(h, key);
-            if (result != nullptr) {
-                *value = *result->val.load();
-                return true;
-            }
-            return false;
+    /**
+    * Heterogeneous lookups, available when both Hash and KeyEqual
+    * declare is_transparent: the key may be any type they accept
+    * (e.g. std::string_view or const char* for std::string keys with
+    * StringHash and std::equal_to<>), so no K is materialized.
+    */
+    template <typename Q, typename = TransparentKey<Q>>
+    bool find(const Q& key, V* value) { return findValue(key, value); }
+
+    template <typename Q, typename = TransparentKey<Q>>
+    ConstKeyValueIterator find_reference(const Q& key) { return findReference(key); }
+
+    bool insert(const K& key, V* value) { return insert(key, value, false); }
+
+    bool insertAbsent(const K& key, const V& value) { return insert(key, const_cast<V*> (&value), true); }
+
+    /**
+    * Inserts every key/value pair of [first, last) whose key is not
+    * already present, like repeated calls to insertAbsent. The table is
+    * presized once for the whole range, the pairs are grouped by bin so
+    * each bin lock is taken once per batch, and a single pin and a single
+    * addCount cover all of them. When a key appears several times in the
+    * range the first occurrence wins.
+    *
+    * @param first, last forward iterators over pairs (->first, ->second)
+    * @return the number of mappings added
+    */
+    template <typename ForwardIt>
+    long insert_bulk(ForwardIt first, ForwardIt last) {
+        std::vector<std::pair<int64_t, ForwardIt>> pending;
+        for (ForwardIt it = first; it != last; ++it) {
+            pending.emplace_back(spread(Hash()(it->first)), it);
         }
+        if (pending.empty()) return 0;
 
-        // wait for treeifyBin...
-        while ((e = e->next.load()) != nullptr) {
-            if (e->hash == h && KeyEqual()(e->key, key)) {
-                *value = *e->val.load();
-                return true;
+        Pin keepPin(this);
+        tryPresize(sumCount() + static_cast<long>(pending.size()), keepPin);
+
+        long added = 0;
+        int check = 0;
+        std::vector<std::pair<int64_t, ForwardIt>> moved;
+        BucketTable* localTable = table.load();
+        while (!pending.empty()) {
+            int64_t n = localTable->length;
+            std::atomic<Node*>* tab = localTable->tableArray;
+            Node* forwarder = nullptr;
+            // stable, so duplicates keep their order and the first one wins.
+            std::stable_sort(pending.begin(), pending.end(),
+                             [n](const std::pair<int64_t, ForwardIt>& a, const std::pair<int64_t, ForwardIt>& b) {
+                                 return ((n - 1) & a.first) < ((n - 1) & b.first);
+                             });
+
+            for (size_t lo = 0, hi; lo < pending.size(); lo = hi) {
+                int64_t i = (n - 1) & pending[lo].first;
+                for (hi = lo + 1; hi < pending.size() && ((n - 1) & pending[hi].first) == i; ++hi) {}
+
+                int binCount = putBin(localTable, i, pending.begin() + lo, pending.begin() + hi,
+                                      added);
+                if (binCount < 0) {
+                    forwarder = tabAt(tab, i);
+                    moved.insert(moved.end(), pending.begin() + lo, pending.begin() + hi);
+                    continue;
+                }
+                if (binCount >= TREEIFY_THRESHOLD)
+                    treeifyBin(localTable, i, keepPin);
+                check = std::max(check, binCount);
             }
+
+            pending.swap(moved);
+            moved.clear();
+            if (forwarder != nullptr)
+                localTable = helpTransfer(localTable, forwarder, keepPin);
         }
 
-        return false;
+        if (added > 0)
+            addCount(added, check, keepPin);
+        return added;
+    }
+
+    /**
+    * Removes the key (and its corresponding value) from this map.
+    * This method does nothing if the key is not in the map.
+    *
+    * @param  key the key that needs to be removed
+    * @return the previous value associated with {@code key}, or
+    *         {@code null} if there was no mapping for {@code key}
+    * @throws NullPointerException if the specified key is null
+    */
+    bool erase(const K& key, V* value) { return erase(key, value, false); }
+
+    bool eraseEqual(const K& key, const V& value) {
+        return erase(key, const_cast<V*> (&value), true);
     }
 
-    ConstKeyValueIterator find_reference(const K& key) {
+    template <typename Q, typename = TransparentKey<Q>>
+    bool erase(const Q& key, V* value) { return erase(key, value, false); }
+
+    template <typename Q, typename = TransparentKey<Q>>
+    bool eraseEqual(const Q& key, const V& value) {
+        return erase(key, const_cast<V*> (&value), true);
+    }
+
+private:
+    /**
+    * Returns the node holding key, or nullptr. The caller must be pinned.
+    */
+    template <typename Q>
+    Node* findNode(const Q& key) {
         BucketTable* localTable;
         std::atomic<Node*>* tab;
         Node* e;
-        int n, eh;
-        int h = spread(Hash()(key));
-        ConstKeyValueIterator iter(this);
+        int64_t n, eh;
+        int64_t h = spread(Hash()(key));
 
         localTable = table.load();
         tab = localTable->tableArray;
         n = localTable->length;
-        if ((e = tabAt(tab, (n - 1) & h)) == nullptr) {
-            iter.reset();
-            return iter;
-        }
+        if ((e = tabAt(tab, (n - 1) & h)) == nullptr) return nullptr;
 
         if ((eh = e->hash) == h) {
             if (KeyEqual()(e->key, key)) {
-                iter.set_node(e);
-                return iter;
+                return e;
             }
         } else if (eh < 0) {
-            Node* result = e->find(h, key);
-            if (result != nullptr) {
-                iter.set_node(result);
-                return iter;
-            }
-            iter.reset();
-            return iter;
+            return findSpecial(e, h, key);
         }
 
         // wait for treeifyBin...
         while ((e = e->next.load()) != nullptr) {
             if (e->hash == h && KeyEqual()(e->key, key)) {
-                iter.set_node(e);
-                return iter;
+                return e;
             }
         }
 
-        iter.reset();
-        return iter;
+        return nullptr;
     }
 
-    bool insert(const K& key, V* value) { return insert(key, value, false); }
+    template <typename Q>
+    bool findValue(const Q& key, V* value) {
+        Pin keepPin(this);
+        Node* e = findNode(key);
+        if (e == nullptr) return false;
+        e->val.load(value);
+        return true;
+    }
 
-    bool insertAbsent(const K& key, const V& value) { return insert(key, const_cast<V*> (&value), true); }
+    template <typename Q>
+    ConstKeyValueIterator findReference(const Q& key) {
+        ConstKeyValueIterator iter(this);
+        Node* e = findNode(key);
+        if (e != nullptr)
+            iter.set_node(e);
+        else
+            iter.reset();
+        return iter;
+    }
 
     /**
-    * Removes the key (and its corresponding value) from this map.
-    * This method does nothing if the key is not in the map.
+    * Inserts the absent keys of [begin, end), which all hash to bin i of
+    * localTable, under one acquisition of the bin lock (or a single CAS of
+    * a prebuilt chain when the bin is empty).
     *
-    * @param  key the key that needs to be removed
-    * @return the previous value associated with {@code key}, or
-    *         {@code null} if there was no mapping for {@code key}
-    * @throws NullPointerException if the specified key is null
+    * @return the bin's node count, or -1 if the bin has been moved
     */
-    bool erase(const K& key, V* value) { return erase(key, value, false); }
+    template <typename PendingIt>
+    int putBin(BucketTable* localTable, int64_t i, PendingIt begin, PendingIt end, long& added) {
+        std::atomic<Node*>* tab = localTable->tableArray;
+        for (;;) {
+            Node* f = tabAt(tab, i);
+            if (f == nullptr) {
+                Node* head = nullptr;
+                Node* tail = nullptr;
+                int binCount = 0;
+                for (PendingIt p = begin; p != end; ++p) {
+                    Node* e = head;
+                    while (e != nullptr && !(e->hash == p->first && KeyEqual()(e->key, p->second->first)))
+                        e = e->next.load();
+                    if (e != nullptr) continue;
+
+                    Node* node = new Node(p->first, p->second->first, p->second->second);
+                    if (tail == nullptr)
+                        head = node;
+                    else
+                        tail->next.store(node);
+                    tail = node;
+                    ++binCount;
+                }
+                if (casTabAt(tab, i, f, head)) {
+                    added += binCount;
+                    return binCount;
+                }
+                while (head != nullptr) {
+                    Node* next = head->next.load();
+                    head->shallow = false;
+                    delete head;
+                    head = next;
+                }
+                continue;
+            }
 
-    bool eraseEqual(const K& key, const V& value) {
-        return erase(key, const_cast<V*> (&value), true);
+            if (f->hash == MOVED) return -1;
+
+            std::lock_guard<std::mutex> control(binLock(i));
+            if (f != tabAt(tab, i)) continue;
+
+            int binCount = 0;
+            if (f->hash >= 0) {
+                Node* pred = nullptr;
+                for (Node* e = f; e != nullptr; e = e->next.load()) {
+                    pred = e;
+                    ++binCount;
+                }
+                for (PendingIt p = begin; p != end; ++p) {
+                    Node* e = f;
+                    while (e != nullptr && !(e->hash == p->first && KeyEqual()(e->key, p->second->first)))
+                        e = e->next.load();
+                    if (e != nullptr) continue;
+
+                    Node* node = new Node(p->first, p->second->first, p->second->second);
+                    pred->next.store(node);
+                    pred = node;
+                    ++binCount;
+                    ++added;
+                }
+            } else {
+                TreeBin* tb = static_cast<TreeBin*>(f);
+                for (PendingIt p = begin; p != end; ++p) {
+                    if (tb->putTreeVal(p->first, p->second->first, p->second->second) == nullptr)
+                        ++added;
+                }
+                // tree bins are never treeified again.
+                binCount = 2;
+            }
+            return binCount;
+        }
     }
 
-private:
     bool insert(const K& key, V* value, const bool absent) {
-        int hash = spread(Hash()(key));
+        int64_t hash = spread(Hash()(key));
         int binCount = 0;
         std::atomic<Node*>* tab;
         Node* f;
-        int n, i, fh;
+        int64_t n, i, fh;
 
         Pin keepPin(this);
         BucketTable* localTable = table.load();
@@ -1573,7 +2333,7 @@ private:
                 return false;
             } else {
                 DelayDispose delayDispose;
-                std::lock_guard<std::mutex> control(localTable->lock_levels[i]);
+                std::lock_guard<std::mutex> control(binLock(i));
 
                 // take bucket's head.
                 if (f == tabAt(tab, i)) {
@@ -1581,20 +2341,14 @@ private:
                         binCount = 1;
                         for (Node* e = f;; ++binCount) {
                             if ((e->hash == hash) && KeyEqual()(e->key, key)) {
-                                auto old = e->val.load();
                                 if (!absent) {
-                                    e->val.store(new V(*value));
-                                    keepPin.retire<RecSingleNode<V>>(sizeof(V), old);
+                                    e->val.replace(*value, value, keepPin);
                                 }
 
                                 delayDispose.ptr = ([=, &keepPin]() {
                                     if (binCount >= TREEIFY_THRESHOLD) {
                                         treeifyBin(localTable, i, keepPin);
                                     }
-
-                                    if (!absent) {
-                                        *value = *old;
-                                    }
                                 });
 
                                 if (absent) {
@@ -1619,12 +2373,9 @@ private:
                     } else {
                         TreeBin* tb = static_cast<TreeBin*>(f);
                         Node* p;
-                        if ((p = tb->putTreeVal(hash, key, *value, keepPin)) != nullptr) {
+                        if ((p = tb->putTreeVal(hash, key, *value)) != nullptr) {
                             if (!absent) {
-                                auto old = p->val.load();
-                                p->val.store(new V(*value));
-                                keepPin.retire<RecSingleNode<V>>(sizeof(V), old);
-                                *value = *old;
+                                p->val.replace(*value, value, keepPin);
                             }
 
                             if (absent) {
@@ -1648,12 +2399,13 @@ private:
         return true;
     }
 
-    bool erase(const K& key, V* value, const bool equal) {
-        int hash = spread(Hash()(key));
+    template <typename Q>
+    bool erase(const Q& key, V* value, const bool equal) {
+        int64_t hash = spread(Hash()(key));
         std::atomic<Node*>* tab;
 
         Node* f;
-        int n, i, fh;
+        int64_t n, i, fh;
 
         Pin keepPin(this);
         BucketTable* localTable = table.load();
@@ -1667,9 +2419,8 @@ private:
                 continue;
             }
 
-            const V* oldVal = nullptr;
             DelayDispose delayDispose;
-            std::lock_guard<std::mutex> control(localTable->lock_levels[i]);
+            std::lock_guard<std::mutex> control(binLock(i));
 
             // take bucket's head.
             if (f == tabAt(tab, i)) {
@@ -1678,8 +2429,7 @@ private:
                     for (Node* e = f;;) {
                         // const K* ek;
                         if (e->hash == hash && KeyEqual()(e->key, key)) {
-                            oldVal = e->val.load();
-                            if (!equal || (*oldVal) == (*value)) {
+                            if (!equal || e->val.equals(*value)) {
                                 if (pred != nullptr) {
                                     pred->next.store(e->next.load());
                                 } else {
@@ -1691,7 +2441,7 @@ private:
                                     keepPin.retire<RecSingleNode<Node>>(sizeof(Node), e);
                                     addCount(-1L, -1, keepPin);
                                     if (!equal) {
-                                        *value = *oldVal;
+                                        e->val.load(value);
                                     }
                                 };
 
@@ -1712,8 +2462,7 @@ private:
                     TreeNode* p;
                     //int value;
                     if ((r = t->root) != nullptr && (p = r->findTreeNode(hash, key)) != nullptr) {
-                        oldVal = p->val.load();
-                        if (!equal || (*oldVal) == (*value)) {
+                        if (!equal || p->val.equals(*value)) {
                             if (t->removeTreeNode(p, keepPin, delayDispose)) {
                                 int num = 0;
                                 setTabAt(tab, i, untreeify(t->first, num));
@@ -1732,7 +2481,7 @@ private:
                                     ptr();
                                 addCount(-1L, -1, keepPin);
                                 if (!equal) {
-                                    *value = *oldVal;
+                                    p->val.load(value);
                                 }
                             };
 
@@ -16,61 +16,217 @@
 #include <algorithm>
 #include <atomic>
 #include <cassert>
-#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <mutex>
+#include <new>
 #include <optional>
 #include <random>
-#include <stack>
 #include <thread>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 namespace sebr {
+// A one-shot permit in a single word, like LockSupport.park/unpark: unpark
+// leaves a permit that the next park consumes. park spins for a while (the
+// budget adapts to how often spinning paid off) before sleeping on the word
+// with atomic::wait in C++20, a futex on Linux, or yielding elsewhere.
 class Blocking {
-public:
-    std::mutex mtx;
-    std::condition_variable cv;
-    bool flag;
+    static constexpr int32_t EMPTY = 0;
+    static constexpr int32_t PERMIT = 1;
+    static constexpr int32_t PARKED = 2;
+
+    static constexpr int32_t MIN_SPINS = 16;
+    static constexpr int32_t MAX_SPINS = 4096;
 
 public:
-    Blocking() : mtx(), cv(), flag(false) {}
+    Blocking() : state(EMPTY), spins(MIN_SPINS * 4) {}
 
     void unpark() {
-        std::unique_lock<std::mutex> control(mtx);
-        if (!flag) {
-            flag = true;
-            cv.notify_one();
+        // the common unpark-before-park race costs this exchange only.
+        if (state.exchange(PERMIT) == PARKED) {
+            wake();
         }
     }
 
+    // consumes a pending permit without waiting; true if there was one.
+    bool try_park() {
+        int32_t s = PERMIT;
+        return state.compare_exchange_strong(s, EMPTY);
+    }
+
     void park() {
-        std::unique_lock<std::mutex> control(mtx);
-        while (!flag) {
-            cv.wait(control);
+        bool slept = false;
+        int32_t budget = spins.load(std::memory_order_relaxed);
+        for (int32_t i = 0;; ++i) {
+            int32_t s = state.load();
+            if (s == PERMIT) {
+                if (state.compare_exchange_weak(s, EMPTY)) {
+                    spins.store(slept ? std::max(budget / 2, MIN_SPINS) : std::min(budget * 2, MAX_SPINS),
+                                std::memory_order_relaxed);
+                    return;
+                }
+            } else if (i < budget) {
+                relax();
+            } else if (s == PARKED || state.compare_exchange_weak(s, PARKED)) {
+                slept = true;
+                wait();
+            }
         }
-        flag = false;
     }
+
+private:
+    static void relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    void wait() {
+#if __cplusplus >= 202002L
+        state.wait(PARKED);
+#elif defined(__linux__)
+        syscall(SYS_futex, reinterpret_cast<int32_t*>(&state), FUTEX_WAIT_PRIVATE, PARKED, nullptr,
+                nullptr, 0);
+#else
+        std::this_thread::yield();
+#endif
+    }
+
+    void wake() {
+#if __cplusplus >= 202002L
+        state.notify_all();
+#elif defined(__linux__)
+        syscall(SYS_futex, reinterpret_cast<int32_t*>(&state), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr,
+                nullptr, 0);
+#endif
+    }
+
+    static_assert(sizeof(std::atomic<int32_t>) == sizeof(int32_t) &&
+                          std::atomic<int32_t>::is_always_lock_free,
+                  "the futex word must be a plain int");
+
+    std::atomic<int32_t> state;
+    // a hint shared by every thread that parks here (the owner of a handle
+    // and a bridge tearing it down, say), so relaxed accesses do.
+    std::atomic<int32_t> spins;
 };
 
-class Base {
+// Per-thread free lists of small blocks, one list per 16-byte size class.
+// A block goes to the free list of whichever thread frees it: usually the one
+// that retired it, but adopted orphans, background batches and parallel
+// teardown free on other threads. It is deleted instead when that list is
+// full or the thread's cache has already been torn down.
+class LocalPool {
+    static constexpr size_t GRANULE = 16;
+    static constexpr size_t NUM_CLASSES = 16;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    // trivially destructible, so it stays readable while the thread's other
+    // thread_local objects are being destroyed.
+    struct Cache {
+        FreeBlock* heads[NUM_CLASSES];
+        size_t nums[NUM_CLASSES];
+        bool dead;
+    };
+
+    class Drainer {
+    public:
+        ~Drainer() {
+            Cache& c = cache();
+            for (size_t i = 0; i < NUM_CLASSES; ++i) {
+                while (c.heads[i] != nullptr) {
+                    FreeBlock* next = c.heads[i]->next;
+                    ::operator delete(c.heads[i]);
+                    c.heads[i] = next;
+                }
+                c.nums[i] = 0;
+            }
+            c.dead = true;
+        }
+    };
+
+    static Cache& cache() {
+        thread_local Cache c = {};
+        return c;
+    }
+
 public:
-    virtual void reclaim() {}
-    virtual ~Base() {}
+    static void* allocate(size_t size) {
+        if (size == 0 || size > GRANULE * NUM_CLASSES) {
+            return ::operator new(size);
+        }
+
+        size_t index = (size - 1) / GRANULE;
+        Cache& c = cache();
+        FreeBlock* block = c.heads[index];
+        if (block == nullptr) {
+            return ::operator new((index + 1) * GRANULE);
+        }
+        c.heads[index] = block->next;
+        --c.nums[index];
+        return block;
+    }
+
+    static void deallocate(void* ptr, size_t size, size_t capacity) {
+        if (size == 0 || size > GRANULE * NUM_CLASSES) {
+            ::operator delete(ptr);
+            return;
+        }
 
-    void static reclaim(Base* obj) {
-        obj->reclaim();
-        delete obj;
+        size_t index = (size - 1) / GRANULE;
+        Cache& c = cache();
+        if (c.dead || c.nums[index] >= capacity) {
+            ::operator delete(ptr);
+            return;
+        }
+
+        thread_local Drainer drainer;
+        (void)drainer;
+        FreeBlock* block = static_cast<FreeBlock*>(ptr);
+        block->next = c.heads[index];
+        c.heads[index] = block;
+        ++c.nums[index];
     }
 };
 
+// Routes new/delete of T (and of classes derived from it) through LocalPool,
+// keeping at most N free blocks per size class and thread.
+template <typename T, size_t N>
+class Stock {
+public:
+    static void* operator new(size_t size) {
+        static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+                      "over-aligned types cannot be pooled");
+        return LocalPool::allocate(size);
+    }
+
+    static void operator delete(void* ptr, size_t size) { LocalPool::deallocate(ptr, size, N); }
+};
+
+// Base for reclaim records. A record is built in place inside its RecWithEpoch
+// and its reclaim() is reached through a plain function pointer, so it must
+// not be polymorphic; keep it to a few trivially copyable pointers.
 template <typename T>
-class ReclaimBridge : public Base {
+class ReclaimBridge {
 public:
-    virtual void reclaim() {}
-    virtual ~ReclaimBridge() {}
+    void reclaim() {}
 };
 
 template <typename T>
@@ -86,16 +242,359 @@ private:
 };
 
 class RecWithEpoch {
-    Base* recObj;
+    static constexpr size_t INLINE_BYTES = 3 * sizeof(void*);
+
+    // storage holds the record itself, or a pointer to it for records that
+    // do not fit inline.
+    alignas(void*) unsigned char storage[INLINE_BYTES];
+    void (*reclaimer)(void*);
     uint64_t epoch;
     int64_t bytes_rec;
 
 public:
-    RecWithEpoch(Base* recObj, int64_t epoch, int64_t bytes_rec)
-            : recObj(recObj), epoch(epoch), bytes_rec(bytes_rec) {}
+    template <typename T>
+    static constexpr bool is_inline() {
+        return sizeof(T) <= INLINE_BYTES && alignof(T) <= alignof(void*) &&
+               std::is_trivially_copyable<T>::value && std::is_trivially_destructible<T>::value;
+    }
+
+    RecWithEpoch() : storage(), reclaimer(nullptr), epoch(0), bytes_rec(0) {}
+
+    template <typename T, typename... Args>
+    RecWithEpoch(std::in_place_type_t<T>, int64_t epoch, int64_t bytes_rec, Args&&... args)
+            : storage(), reclaimer(nullptr), epoch(epoch), bytes_rec(bytes_rec) {
+        if constexpr (is_inline<T>()) {
+            new (storage) T(std::forward<Args>(args)...);
+            reclaimer = [](void* rec) -> void { std::launder(static_cast<T*>(rec))->reclaim(); };
+        } else {
+            T* rec = new T(std::forward<Args>(args)...);
+            std::memcpy(storage, &rec, sizeof(rec));
+            reclaimer = [](void* ptr) -> void {
+                T* rec;
+                std::memcpy(&rec, ptr, sizeof(rec));
+                rec->reclaim();
+                delete rec;
+            };
+        }
+    }
+
     uint64_t getEpoch() { return epoch; }
-    Base* getRecObj() { return recObj; }
     int64_t getBytesForRec() { return bytes_rec; }
+    void reclaim() { reclaimer(storage); }
+};
+
+// FIFO of retired records, stored in fixed-size segments. A thread retires in
+// non-decreasing epoch order, so reclaiming the expired prefix only touches the
+// reclaimed records, and a segment whose newest record has expired is handed
+// out in one go without comparing every epoch.
+class LimboList {
+    class Segment {
+    public:
+        static constexpr int32_t CAPACITY = 128;
+
+        Segment() : recs(), head(0), tail(0), next(nullptr) {}
+
+        RecWithEpoch recs[CAPACITY];
+        int32_t head;
+        int32_t tail;
+        Segment* next;
+    };
+
+public:
+    LimboList() : first(nullptr), last(nullptr), spare(nullptr), num(0) {}
+
+    LimboList(const LimboList&) = delete;
+    LimboList& operator=(const LimboList&) = delete;
+
+    ~LimboList() {
+        while (first != nullptr) {
+            Segment* next = first->next;
+            delete first;
+            first = next;
+        }
+        delete spare;
+    }
+
+    bool empty() const { return num == 0; }
+
+    size_t size() const { return num; }
+
+    RecWithEpoch& front() { return first->recs[first->head]; }
+
+    RecWithEpoch& back() { return last->recs[last->tail - 1]; }
+
+    void push_back(const RecWithEpoch& rec) {
+        if (last == nullptr || last->tail == Segment::CAPACITY) {
+            Segment* segment = acquire_segment();
+            if (last == nullptr) {
+                first = last = segment;
+            } else {
+                last->next = segment;
+                last = segment;
+            }
+        }
+        last->recs[last->tail++] = rec;
+        ++num;
+    }
+
+    void pop_front() {
+        ++first->head;
+        --num;
+        if (first->head == first->tail) {
+            release_front();
+        }
+    }
+
+    // Hands every record older than 'min_epoch' to 'f' and drops it from the
+    // list. Stops at the first record that is still visible.
+    template <typename F>
+    void reclaim_before(uint64_t min_epoch, F&& f) {
+        while (first != nullptr) {
+            Segment* segment = first;
+            if (segment->recs[segment->tail - 1].getEpoch() < min_epoch) {
+                // the whole segment has expired.
+                for (int32_t i = segment->head; i < segment->tail; ++i) {
+                    f(segment->recs[i]);
+                }
+                num -= segment->tail - segment->head;
+                release_front();
+                continue;
+            }
+
+            while (segment->recs[segment->head].getEpoch() < min_epoch) {
+                f(segment->recs[segment->head]);
+                pop_front();
+            }
+            return;
+        }
+    }
+
+    // Like reclaim_before, but stops once the records handed out add up to
+    // 'budget' bytes. Returns false if expired records were left behind.
+    template <typename F>
+    bool reclaim_bounded(uint64_t min_epoch, int64_t budget, F&& f) {
+        while (first != nullptr) {
+            RecWithEpoch& rec = front();
+            if (rec.getEpoch() >= min_epoch) return true;
+            if (budget <= 0) return false;
+            budget -= rec.getBytesForRec();
+            f(rec);
+            pop_front();
+        }
+        return true;
+    }
+
+    template <typename F>
+    void reclaim_all(F&& f) {
+        reclaim_before(UINT64_MAX, std::forward<F>(f));
+    }
+
+    // Like reclaim_before, but moves the expired records to the back of 'out'
+    // instead of handing them out; 'f' still sees each one. Fully expired
+    // segments are relinked rather than copied.
+    template <typename F>
+    void move_before(uint64_t min_epoch, LimboList& out, F&& f) {
+        while (first != nullptr) {
+            Segment* segment = first;
+            if (segment->recs[segment->tail - 1].getEpoch() < min_epoch) {
+                for (int32_t i = segment->head; i < segment->tail; ++i) {
+                    f(segment->recs[i]);
+                }
+                size_t moved = segment->tail - segment->head;
+                if ((first = segment->next) == nullptr) {
+                    last = nullptr;
+                }
+                segment->next = nullptr;
+                num -= moved;
+                out.append_segment(segment, moved);
+                continue;
+            }
+
+            while (segment->recs[segment->head].getEpoch() < min_epoch) {
+                f(segment->recs[segment->head]);
+                out.push_back(segment->recs[segment->head]);
+                pop_front();
+            }
+            return;
+        }
+    }
+
+    // Moves every segment of 'other' into this list: behind ours if none of
+    // its records is older than our newest one, in front otherwise, where
+    // records handed over from elsewhere (usually older than ours) belong.
+    // Segments are never merged, so each one stays in epoch order even when
+    // the lists overlap; reclaim_before then just stops earlier.
+    void splice(LimboList& other) {
+        if (other.first == nullptr) return;
+        if (first == nullptr) {
+            first = other.first;
+            last = other.last;
+        } else if (other.front().getEpoch() >= back().getEpoch()) {
+            last->next = other.first;
+            last = other.last;
+        } else {
+            other.last->next = first;
+            first = other.first;
+        }
+        num += other.num;
+        other.first = other.last = nullptr;
+        other.num = 0;
+    }
+
+private:
+    void append_segment(Segment* segment, size_t count) {
+        if (last == nullptr) {
+            first = segment;
+        } else {
+            last->next = segment;
+        }
+        last = segment;
+        num += count;
+    }
+
+    Segment* acquire_segment() {
+        Segment* segment = spare;
+        if (segment == nullptr) {
+            return new Segment();
+        }
+        spare = nullptr;
+        return segment;
+    }
+
+    void release_front() {
+        Segment* segment = first;
+        if ((first = segment->next) == nullptr) {
+            last = nullptr;
+        }
+        segment->head = segment->tail = 0;
+        segment->next = nullptr;
+        if (spare == nullptr) {
+            spare = segment;
+        } else {
+            delete segment;
+        }
+    }
+
+    Segment* first;
+    Segment* last;
+    // keep one drained segment around to avoid malloc churn at the boundary.
+    Segment* spare;
+    size_t num;
+};
+
+// Group-wide cache of the smallest epoch still observed by any thread.
+// Only one thread scans the handle list at a time ('generation' is odd while
+// a scan is running); everyone else reuses the last published value.
+class alignas(64) SafeEpoch {
+public:
+    SafeEpoch() : epoch(0), generation(0) {}
+
+    std::atomic<int64_t> epoch;
+    std::atomic<uint64_t> generation;
+};
+
+// Treiber stack of limbo batches handed from one thread to another: the
+// backlog of exited threads waiting to be adopted, or expired records waiting
+// for a BackgroundReclaimer. Consumers take the whole stack at once.
+class LimboStack {
+public:
+    struct Batch {
+        LimboList recs;
+        int64_t bytes = 0;
+        Batch* next = nullptr;
+    };
+
+    LimboStack() : head(nullptr) {}
+
+    LimboStack(const LimboStack&) = delete;
+    LimboStack& operator=(const LimboStack&) = delete;
+
+    // nobody can take the stack any more, so whatever is left is unreachable.
+    ~LimboStack() { reclaim_all(take_all()); }
+
+    // reclaims every record of the chain of batches and frees the batches.
+    static void reclaim_all(Batch* batch) {
+        while (batch != nullptr) {
+            Batch* next = batch->next;
+            batch->recs.reclaim_all([](RecWithEpoch& recObj) -> void { recObj.reclaim(); });
+            delete batch;
+            batch = next;
+        }
+    }
+
+    bool empty() const { return head.load() == nullptr; }
+
+    void push(Batch* batch) {
+        Batch* h = head.load();
+        do {
+            batch->next = h;
+        } while (!head.compare_exchange_weak(h, batch));
+    }
+
+    Batch* take_all() { return head.exchange(nullptr); }
+
+private:
+    std::atomic<Batch*> head;
+};
+
+// Frees expired limbo batches off the request path: either on a thread of its
+// own, or by handing each batch to a caller-provided executor. Destroying it
+// waits until every batch submitted so far has been freed.
+class BackgroundReclaimer {
+public:
+    using Executor = std::function<void(std::function<void()>)>;
+
+    explicit BackgroundReclaimer(Executor executor)
+            : executor(std::move(executor)), pending(), in_flight(0), stopping(false), blocking() {
+        if (!this->executor) {
+            worker = std::thread([this]() -> void { run(); });
+        }
+    }
+
+    BackgroundReclaimer(const BackgroundReclaimer&) = delete;
+    BackgroundReclaimer& operator=(const BackgroundReclaimer&) = delete;
+
+    ~BackgroundReclaimer() {
+        if (worker.joinable()) {
+            stopping.store(true);
+            blocking.unpark();
+            worker.join();
+        }
+        while (in_flight.load() != 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    void submit(LimboStack::Batch* batch) {
+        if (executor) {
+            in_flight.fetch_add(1);
+            executor([this, batch]() -> void {
+                LimboStack::reclaim_all(batch);
+                in_flight.fetch_sub(1);
+            });
+        } else {
+            pending.push(batch);
+            blocking.unpark();
+        }
+    }
+
+private:
+    void run() {
+        for (;;) {
+            LimboStack::reclaim_all(pending.take_all());
+            if (stopping.load()) return;
+            blocking.park();
+        }
+    }
+
+    Executor executor;
+    // batches waiting for the worker thread.
+    LimboStack pending;
+    // batches handed to the executor and not freed yet.
+    std::atomic<int64_t> in_flight;
+    std::atomic<bool> stopping;
+    Blocking blocking;
+    std::thread worker;
 };
 
 template <typename T>
@@ -208,6 +707,10 @@ public:
     PackedHandle(ConcurrentBridge<T>* bridge);
     PackedHandle(ThreadHandle* owed);
 
+    // a copy is one more (nested) pin on the same handle.
+    PackedHandle(const PackedHandle& other);
+    PackedHandle& operator=(const PackedHandle& other);
+
     template <typename T, typename... Args>
     void retire(int64_t bytes, Args&&... args);
 
@@ -228,15 +731,23 @@ public:
 class ThreadHandle : public NextWithUnpin<ThreadHandle> {
 public:
     ThreadHandle(ThreadHandle* sentinel, std::atomic<int64_t>* global_epoch_ptr,
-                 int32_t bytes_gc_threshold, int32_t bytes_epoch_threshold)
+                 SafeEpoch* safe_epoch_ptr, LimboStack* orphans_ptr,
+                 std::atomic<BackgroundReclaimer*>* reclaimer_ptr, int32_t bytes_gc_threshold,
+                 int32_t bytes_epoch_threshold, int32_t bytes_reclaim_budget)
             : NextWithUnpin(sentinel),
               epoch(-1),
               global_epoch_ptr(global_epoch_ptr),
+              safe_epoch_ptr(safe_epoch_ptr),
+              orphans_ptr(orphans_ptr),
+              reclaimer_ptr(reclaimer_ptr),
               heap_tabs(),
               bytes_accumulate(0),
               bytes_gc_threshold(bytes_gc_threshold),
               bytes_epoch_threshold(bytes_epoch_threshold),
+              bytes_reclaim_budget(bytes_reclaim_budget),
+              backlog_epoch(0),
               epoch_add_lastbytes(0),
+              pin_depth(0),
               control() {
         this->pin();
     }
@@ -245,23 +756,47 @@ public:
             : NextWithUnpin(),
               epoch(-1),
               global_epoch_ptr(nullptr),
+              safe_epoch_ptr(nullptr),
+              orphans_ptr(nullptr),
+              reclaimer_ptr(nullptr),
               heap_tabs(),
               bytes_accumulate(0),
               bytes_gc_threshold(0),
               bytes_epoch_threshold(0),
+              bytes_reclaim_budget(0),
+              backlog_epoch(0),
               epoch_add_lastbytes(0),
+              pin_depth(0),
               control() {}
 
     void unbind(std::function<void()> f) { this->unpin(f); }
 
+    // Pins nest: only the outermost one publishes the epoch, and only its
+    // release clears it and reclaims, so an inner pin costs a counter bump.
     ThreadHandle* lock_guard() {
-        epoch.store(global_epoch_ptr->load());
+        if (pin_depth++ == 0) {
+            epoch.store(global_epoch_ptr->load());
+        }
         return this;
     }
 
     ThreadHandle* unguard() {
-        epoch.store(LEAVE);
-        reclaim(bytes_gc_threshold);
+        assert(pin_depth > 0);
+        if (--pin_depth == 0) {
+            epoch.store(LEAVE);
+            reclaim(bytes_gc_threshold);
+        }
+        return this;
+    }
+
+    // Moves the only pin of this thread up to the current epoch, reclaiming in
+    // between. Does nothing under nested pins, which still need the old one.
+    ThreadHandle* refresh() {
+        if (pin_depth == 1) {
+            epoch.store(LEAVE);
+            reclaim(bytes_gc_threshold);
+            epoch.store(global_epoch_ptr->load());
+        }
         return this;
     }
 
@@ -275,50 +810,134 @@ public:
     template <typename T, typename... Args>
     void retire(int64_t bytes, Args&&... args) {
         int64_t epoch = global_epoch_ptr->load();
-        try_increase_epoch(bytes += sizeof(T), global_epoch_ptr);
-        heap_tabs.emplace_back(new T(std::forward<Args>(args)...), epoch, bytes);
+        if constexpr (!RecWithEpoch::is_inline<T>()) {
+            bytes += sizeof(T);
+        }
+        try_increase_epoch(bytes, global_epoch_ptr);
+        heap_tabs.push_back(
+                RecWithEpoch(std::in_place_type<T>, epoch, bytes, std::forward<Args>(args)...));
+    }
+
+    // Called by an exiting thread before it unbinds: hands the records that
+    // are still pending to the group instead of leaving them until the
+    // bridge is destroyed. Nothing is reclaimed here, as this thread's
+    // thread_local state may already be gone.
+    void orphan() {
+        if (heap_tabs.empty()) return;
+        auto batch = new LimboStack::Batch();
+        batch->recs.splice(heap_tabs);
+        batch->bytes = bytes_accumulate;
+        bytes_accumulate = 0;
+        epoch_add_lastbytes = 0;
+        orphans_ptr->push(batch);
+    }
+
+    // Takes over the backlog of exited threads; it is reclaimed along with
+    // this thread's own records.
+    void adopt_orphans() {
+        LimboStack::Batch* batch = orphans_ptr->take_all();
+        while (batch != nullptr) {
+            LimboStack::Batch* next = batch->next;
+            heap_tabs.splice(batch->recs);
+            bytes_accumulate += batch->bytes;
+            // adopted bytes were already counted towards the epoch.
+            epoch_add_lastbytes += batch->bytes;
+            delete batch;
+            batch = next;
+        }
     }
 
     void clean() {
-        int32_t rec_num = 0;
-        for (auto& recObj : heap_tabs) {
+        heap_tabs.reclaim_all([this](RecWithEpoch& recObj) -> void {
             // reclaim unused memory.
-            int64_t bytes_to_reclaim = recObj.getBytesForRec();
-            auto rec = recObj.getRecObj();
-            Base::reclaim(rec);
-            bytes_accumulate -= bytes_to_reclaim;
-            ++rec_num;
+            recObj.reclaim();
+            bytes_accumulate -= recObj.getBytesForRec();
+        });
+    }
+
+    // Walk the whole group and publish the smallest epoch in use. If another
+    // thread is already scanning, reuse the currently published value instead.
+    uint64_t scan_safe_epoch() {
+        uint64_t generation = safe_epoch_ptr->generation.load();
+        if ((generation & 1) != 0 ||
+            !safe_epoch_ptr->generation.compare_exchange_strong(generation, generation + 1)) {
+            return safe_epoch_ptr->epoch.load();
+        }
+
+        uint64_t min_epoch = global_epoch_ptr->load();
+        ThreadHandle* handle = sentinel->next.load();
+        while (handle != sentinel) {
+            uint64_t th_epoch = handle->epoch.load();
+            min_epoch = std::min(min_epoch, th_epoch);
+            handle = ThreadHandle::untagged_address(handle->next.load());
         }
-        heap_tabs.erase(heap_tabs.begin(), heap_tabs.begin() + rec_num);
+
+        // epochs only grow, so never move the published value backwards.
+        int64_t published = safe_epoch_ptr->epoch.load();
+        while (published < static_cast<int64_t>(min_epoch) &&
+               !safe_epoch_ptr->epoch.compare_exchange_weak(published, min_epoch)) {
+        }
+        safe_epoch_ptr->generation.store(generation + 2);
+        return std::max<uint64_t>(published, min_epoch);
     }
 
     void reclaim(int64_t threshold) {
+        if (!orphans_ptr->empty()) {
+            adopt_orphans();
+        }
         if (bytes_accumulate > threshold) {
             if (heap_tabs.empty()) return;
 
-            uint64_t min_epoch = global_epoch_ptr->load();
-            if (heap_tabs[0].getEpoch() == min_epoch) {
+            uint64_t oldest_epoch = heap_tabs.front().getEpoch();
+            if (oldest_epoch >= static_cast<uint64_t>(global_epoch_ptr->load())) {
                 return;
             }
 
-            ThreadHandle* handle = sentinel->next.load();
-            while (handle != sentinel) {
-                uint64_t th_epoch = handle->epoch.load();
-                min_epoch = std::min(min_epoch, th_epoch);
-                handle = ThreadHandle::untagged_address(handle->next.load());
+            // the cached epoch is still a valid bound: it was the minimum at some
+            // earlier point and every later pin loads an epoch at least that big.
+            uint64_t min_epoch = safe_epoch_ptr->epoch.load();
+            if (oldest_epoch >= min_epoch) {
+                min_epoch = scan_safe_epoch();
             }
 
-            int32_t rec_num = 0;
-            for (RecWithEpoch& recObj : heap_tabs) {
-                if (recObj.getEpoch() >= min_epoch) break;
-                // reclaim unused memory.
-                int64_t bytes_to_reclaim = recObj.getBytesForRec();
-                auto rec = recObj.getRecObj();
-                Base::reclaim(rec);
-                bytes_accumulate -= bytes_to_reclaim;
-                ++rec_num;
+            BackgroundReclaimer* background = reclaimer_ptr->load();
+            if (background != nullptr) {
+                // leave the freeing to the background reclaimer.
+                auto batch = new LimboStack::Batch();
+                heap_tabs.move_before(min_epoch, batch->recs, [this](RecWithEpoch& recObj) -> void {
+                    bytes_accumulate -= recObj.getBytesForRec();
+                });
+                if (batch->recs.empty()) {
+                    delete batch;
+                } else {
+                    background->submit(batch);
+                }
+                return;
             }
-            heap_tabs.erase(heap_tabs.begin(), heap_tabs.begin() + rec_num);
+
+            release_expired(min_epoch);
+        } else if (backlog_epoch != 0) {
+            // carry on with what an earlier pass left over for lack of budget.
+            release_expired(backlog_epoch);
+        }
+    }
+
+    // Frees the records older than 'min_epoch', at most bytes_reclaim_budget
+    // bytes' worth (but always at least one record) when a budget is set.
+    // Not used with a BackgroundReclaimer: reclaim() then hands the whole
+    // expired prefix over in one batch, so the budget does not apply.
+    void release_expired(uint64_t min_epoch) {
+        auto f = [this](RecWithEpoch& recObj) -> void {
+            // reclaim unused memory.
+            recObj.reclaim();
+            bytes_accumulate -= recObj.getBytesForRec();
+        };
+        if (bytes_reclaim_budget <= 0) {
+            heap_tabs.reclaim_before(min_epoch, f);
+        } else if (heap_tabs.reclaim_bounded(min_epoch, bytes_reclaim_budget, f)) {
+            backlog_epoch = 0;
+        } else {
+            backlog_epoch = min_epoch;
         }
     }
 
@@ -327,115 +946,254 @@ private:
     std::atomic<int64_t> epoch;
     // global epoch for this threads group.
     std::atomic<int64_t>* global_epoch_ptr;
-    std::vector<RecWithEpoch> heap_tabs;
+    // cached safe epoch for this threads group.
+    SafeEpoch* safe_epoch_ptr;
+    // backlog of exited threads in this threads group.
+    LimboStack* orphans_ptr;
+    // set when this threads group frees expired records in the background.
+    std::atomic<BackgroundReclaimer*>* reclaimer_ptr;
+    LimboList heap_tabs;
     int64_t bytes_accumulate;
     int32_t bytes_gc_threshold;
     int32_t bytes_epoch_threshold;
+    // bytes freed per unguard at most, 0 for no limit.
+    int32_t bytes_reclaim_budget;
+    // safe epoch of a pass that ran out of budget, 0 if none is pending.
+    uint64_t backlog_epoch;
     int64_t epoch_add_lastbytes;
+    // live pins of this thread on the group.
+    int32_t pin_depth;
     constexpr static int64_t LEAVE = -1;
 
 public:
     ConcurrencyControl control;
 };
 
+// Lock-free id recycling: freed ids form a Treiber stack whose head packs an
+// ABA tag (high 32 bits) with id + 1 (low 32 bits, 0 when empty). The links
+// live in chunks reached through a two-level directory indexed by id; only
+// the small root is part of the allocator, the rest is installed on first use
+// and never freed before the allocator, so a popper may read a stale link but
+// its CAS then fails on the tag.
 class IdAllocator {
+    static constexpr uint32_t CHUNK_BITS = 12;
+    static constexpr uint32_t CHUNK_SIZE = 1U << CHUNK_BITS;
+    static constexpr uint32_t MID_BITS = 12;
+    static constexpr uint32_t MID_SIZE = 1U << MID_BITS;
+    static constexpr uint32_t ROOT_SIZE = 1U << (32 - MID_BITS - CHUNK_BITS);
+    static constexpr uint64_t ID_MASK = 0xffffffffULL;
+
+    using Chunk = std::atomic<uint32_t>;
+    using Mid = std::atomic<Chunk*>;
+
 public:
-    IdAllocator() : upper_bound(0), freed(), lock() {}
+    IdAllocator() : upper_bound(0), freed(0), root() {}
+
+    ~IdAllocator() {
+        for (auto& slot : root) {
+            Mid* mid = slot.load();
+            if (mid == nullptr) continue;
+            for (uint32_t i = 0; i < MID_SIZE; ++i) {
+                delete[] mid[i].load();
+            }
+            delete[] mid;
+        }
+    }
+
     size_t allocate() {
-        std::lock_guard<std::mutex> guard(lock);
-        if (freed.empty()) {
-            return upper_bound++;
-        } else {
-            size_t id = freed.top();
-            freed.pop();
-            return id;
+        uint64_t head = freed.load();
+        while ((head & ID_MASK) != 0) {
+            uint32_t id = static_cast<uint32_t>(head & ID_MASK) - 1;
+            uint64_t next = link(id).load();
+            if (freed.compare_exchange_weak(head, next_tag(head) | next)) {
+                return id;
+            }
         }
+        return upper_bound.fetch_add(1);
     }
 
     void deallocate(size_t id) {
-        std::lock_guard<std::mutex> guard(lock);
-        freed.push(id);
+        std::atomic<uint32_t>& next = link(static_cast<uint32_t>(id));
+        uint64_t head = freed.load();
+        do {
+            next.store(static_cast<uint32_t>(head & ID_MASK));
+        } while (!freed.compare_exchange_weak(head, next_tag(head) | (id + 1)));
     }
 
 private:
-    uint32_t upper_bound;
-    std::stack<uint32_t, std::vector<uint32_t>> freed;
+    static uint64_t next_tag(uint64_t head) { return ((head >> 32) + 1) << 32; }
+
+    // returns the array in 'slot', installing a zeroed one of n if empty.
+    template <typename E>
+    static E* install(std::atomic<E*>& slot, uint32_t n) {
+        E* array = slot.load();
+        if (array == nullptr) {
+            auto fresh = new E[n]();
+            if (slot.compare_exchange_strong(array, fresh)) {
+                array = fresh;
+            } else {
+                delete[] fresh;
+            }
+        }
+        return array;
+    }
+
+    std::atomic<uint32_t>& link(uint32_t id) {
+        Mid* mid = install(root[id >> (MID_BITS + CHUNK_BITS)], MID_SIZE);
+        Chunk* chunk = install(mid[(id >> CHUNK_BITS) & (MID_SIZE - 1)], CHUNK_SIZE);
+        return chunk[id & (CHUNK_SIZE - 1)];
+    }
 
-    // TODO: use concurrent_stack or concurrent_queue
-    std::mutex lock;
+    std::atomic<uint32_t> upper_bound;
+    std::atomic<uint64_t> freed;
+    std::atomic<Mid*> root[ROOT_SIZE];
 };
 
 template <typename T>
 class ThreadGroup {
+    // This thread's handles, indexed by group id through a directory of
+    // 64-slot pages. Slots and pages are allocated on first bind, and the
+    // slots of dead groups are swept (and empty pages freed) once enough new
+    // slots have been allocated since the last sweep, so memory follows the
+    // groups this thread actually uses rather than the largest id ever seen.
     class ThreadHandleAggregate {
+        static constexpr uint32_t PAGE_BITS = 6;
+        static constexpr uint32_t PAGE_SIZE = 1U << PAGE_BITS;
+
+        struct Page {
+            ThreadHandle* slots[PAGE_SIZE] = {};
+            uint32_t used = 0;
+        };
+
     public:
-        ThreadHandleAggregate() : handles_vector() {}
+        ThreadHandleAggregate() : pages(), allocated(0), sweep_at(PAGE_SIZE) {}
 
         ThreadHandle* get_thread_handle(ThreadGroup<T>* group, ThreadHandle* sentinel,
-                                        std::atomic<int64_t>* global_epoch,
-                                        int32_t bytes_gc_threshold, int32_t bytes_epoch_threshold) {
-            while (handles_vector.size() <= group->id) {
-                auto handle =
-                        reinterpret_cast<ThreadHandle*>(new std::uint8_t[sizeof(ThreadHandle)]);
-                new (&handle->control) ConcurrencyControl(-2);
-                handles_vector.push_back(handle);
+                                        std::atomic<int64_t>* global_epoch, SafeEpoch* safe_epoch,
+                                        LimboStack* orphans,
+                                        std::atomic<BackgroundReclaimer*>* reclaimer,
+                                        int32_t bytes_gc_threshold, int32_t bytes_epoch_threshold,
+                                        int32_t bytes_reclaim_budget) {
+            uint32_t page_index = group->id >> PAGE_BITS;
+            if (pages.size() <= page_index) {
+                pages.resize(page_index + 1, nullptr);
+            }
+            Page*& page = pages[page_index];
+            if (page == nullptr) {
+                page = new Page();
             }
 
-            auto h = handles_vector[group->id];
-            if (h->control.flag.load() < 0) {
-                group->handle_total.fetch_add(1);
-                new (h) ThreadHandle(sentinel, global_epoch, bytes_gc_threshold,
-                                     bytes_epoch_threshold);
+            auto& h = page->slots[group->id & (PAGE_SIZE - 1)];
+            if (h == nullptr) {
+                if (++allocated >= sweep_at) {
+                    sweep(page);
+                }
+                h = reinterpret_cast<ThreadHandle*>(new std::uint8_t[sizeof(ThreadHandle)]);
+                ++page->used;
+            } else if (h->control.flag.load() >= 0) {
+                return h;
+            } else {
+                // left over from a dead group that had the same id; the dead
+                // group's bridge always leaves a permit once it is done with it.
+                h->control.blocking.park();
+                h->~ThreadHandle();
             }
 
+            group->handle_total.fetch_add(1);
+            new (h) ThreadHandle(sentinel, global_epoch, safe_epoch, orphans, reclaimer,
+                                 bytes_gc_threshold, bytes_epoch_threshold, bytes_reclaim_budget);
             return h;
         }
 
         ~ThreadHandleAggregate() {
-            for (auto iter = handles_vector.begin(); iter != handles_vector.end(); ++iter) {
-                auto handle = *iter;
-                auto& control = handle->control;
-
-                int32_t flag = 0;
-                if (control.flag.load() == -2) {
-                    (&handle->control)->~ConcurrencyControl();
-                    delete[] reinterpret_cast<std::uint8_t*>(handle);
-                } else if (control.flag.load() == flag &&
-                           control.flag.compare_exchange_strong(flag, 1)) {
-                    handle->unbind([&control]() -> void {
-                        control.flag.store(-1);
-                        control.blocking.unpark();
-                    });
-                } else {
-                    do {
-                        control.blocking.park();
-                    } while (control.flag.load() > 0);
+            for (Page* page : pages) {
+                if (page == nullptr) continue;
+                for (ThreadHandle* handle : page->slots) {
+                    if (handle == nullptr) continue;
+                    auto& control = handle->control;
+
+                    int32_t flag = 0;
+                    if (control.flag.load() == flag &&
+                        control.flag.compare_exchange_strong(flag, 1)) {
+                        handle->orphan();
+                        handle->unbind([&control]() -> void {
+                            control.flag.store(-1);
+                            control.blocking.unpark();
+                        });
+                    } else {
+                        do {
+                            control.blocking.park();
+                        } while (control.flag.load() > 0);
+
+                        // delete handle;
+                        handle->~ThreadHandle();
+                        delete[] reinterpret_cast<std::uint8_t*>(handle);
+                    }
+                }
+                delete page;
+            }
+        }
 
-                    // delete handle;
-                    handle->~ThreadHandle();
-                    delete[] reinterpret_cast<std::uint8_t*>(handle);
+    private:
+        // frees the slots of dead groups whose bridge has finished with them,
+        // and the pages left empty (except keep, which is about to be used).
+        void sweep(Page* keep) {
+            allocated = 0;
+            for (Page*& page : pages) {
+                if (page == nullptr) continue;
+                for (ThreadHandle*& handle : page->slots) {
+                    if (handle != nullptr && handle->control.flag.load() == -1 &&
+                        handle->control.blocking.try_park()) {
+                        handle->~ThreadHandle();
+                        delete[] reinterpret_cast<std::uint8_t*>(handle);
+                        handle = nullptr;
+                        --page->used;
+                    }
+                }
+                if (page->used == 0 && page != keep) {
+                    delete page;
+                    page = nullptr;
+                } else {
+                    allocated += page->used;
                 }
             }
+            while (!pages.empty() && pages.back() == nullptr) {
+                pages.pop_back();
+            }
+            // sweep again once the live slots have doubled.
+            sweep_at = std::max(allocated, PAGE_SIZE);
+            allocated = 0;
         }
 
-        std::vector<ThreadHandle*> handles_vector;
+        std::vector<Page*> pages;
+        uint32_t allocated;
+        uint32_t sweep_at;
     };
 
 public:
-    ThreadGroup(int32_t bytes_gc_threshold, int32_t bytes_epoch_threshold)
+    ThreadGroup(int32_t bytes_gc_threshold, int32_t bytes_epoch_threshold,
+                int32_t bytes_reclaim_budget)
             : id(id_allocator.allocate()),
               sentinel(),
               global_epoch(0),
+              safe_epoch(),
+              orphans(),
+              reclaimer(nullptr),
               bytes_gc_threshold(bytes_gc_threshold),
               bytes_epoch_threshold(bytes_epoch_threshold),
+              bytes_reclaim_budget(bytes_reclaim_budget),
               handle_total(0) {}
 
-    ~ThreadGroup() { deallocate(); }
+    ~ThreadGroup() {
+        delete reclaimer.load();
+        deallocate();
+    }
 
     ThreadHandle* bind() {
         thread_local ThreadHandleAggregate aggregate;
         ThreadHandle* handle = aggregate.get_thread_handle(
-                this, &sentinel, &global_epoch, bytes_gc_threshold, bytes_epoch_threshold);
+                this, &sentinel, &global_epoch, &safe_epoch, &orphans, &reclaimer,
+                bytes_gc_threshold, bytes_epoch_threshold, bytes_reclaim_budget);
         return handle;
     }
 
@@ -446,8 +1204,12 @@ public:
     const uint32_t id;
     ThreadHandle sentinel;
     std::atomic<int64_t> global_epoch;
+    SafeEpoch safe_epoch;
+    LimboStack orphans;
+    std::atomic<BackgroundReclaimer*> reclaimer;
     const int32_t bytes_gc_threshold;
     const int32_t bytes_epoch_threshold;
+    const int32_t bytes_reclaim_budget;
     std::atomic<int32_t> handle_total;
 };
 
@@ -459,11 +1221,33 @@ class ConcurrentBridge {
     friend class PackedHandle;
 
 public:
-    ConcurrentBridge(int32_t bytes_gc_threshold = 8192, int32_t bytes_epoch_threshold = 1024)
-            : group(new ThreadGroup<T>(bytes_gc_threshold, bytes_epoch_threshold)) {}
+    static constexpr int32_t DEFAULT_GC_THRESHOLD = 8192;
+    static constexpr int32_t DEFAULT_EPOCH_THRESHOLD = 1024;
+
+    // 'bytes_reclaim_budget' caps how much one unguard frees (0: no cap);
+    // whatever is left over is freed by the following unguards. It has no
+    // effect once reclaim_in_background() is on, as unguard frees nothing.
+    ConcurrentBridge(int32_t bytes_gc_threshold = DEFAULT_GC_THRESHOLD,
+                     int32_t bytes_epoch_threshold = DEFAULT_EPOCH_THRESHOLD,
+                     int32_t bytes_reclaim_budget = 0)
+            : group(new ThreadGroup<T>(bytes_gc_threshold, bytes_epoch_threshold,
+                                       bytes_reclaim_budget)) {}
 
     ThreadHandle* bind() { return group->bind(); }
 
+    // Frees expired records on a background thread of this group (or through
+    // 'executor' when one is given) instead of in the unpinning thread. Only
+    // the first call takes effect; the destructor waits for pending batches.
+    bool reclaim_in_background(BackgroundReclaimer::Executor executor = nullptr) {
+        auto background = new BackgroundReclaimer(std::move(executor));
+        BackgroundReclaimer* expected = nullptr;
+        if (!group->reclaimer.compare_exchange_strong(expected, background)) {
+            delete background;
+            return false;
+        }
+        return true;
+    }
+
     ~ConcurrentBridge() {
         auto handle_num = group->handle_total.load();
 
@@ -501,10 +1285,13 @@ public:
 
         next = sentinel->next.load();
         while (next != sentinel) {
+            // once flagged and unparked the slot belongs to its thread again,
+            // which may free or rebuild the handle, so step past it first.
+            auto temp_obj = next->next.load();
             auto& control = next->control;
             control.flag.store(-1);
             control.blocking.unpark();
-            next = next->next.load();
+            next = temp_obj;
         }
 
         prev = sentinel->prev.load();
@@ -532,6 +1319,19 @@ inline PackedHandle::PackedHandle(ThreadHandle* owed) : owed(owed) {
     owed->lock_guard();
 }
 
+inline PackedHandle::PackedHandle(const PackedHandle& other) : owed(other.owed) {
+    owed->lock_guard();
+}
+
+inline PackedHandle& PackedHandle::operator=(const PackedHandle& other) {
+    if (owed != other.owed) {
+        other.owed->lock_guard();
+        owed->unguard();
+        owed = other.owed;
+    }
+    return *this;
+}
+
 template <typename T, typename... Args>
 inline void PackedHandle::retire(int64_t bytes, Args&&... args) {
     owed->retire<T>(bytes, std::forward<Args>(args)...);
@@ -541,5 +1341,37 @@ inline PackedHandle::~PackedHandle() {
     owed->unguard();
 }
 
+// Pins the calling thread for a whole batch of operations, which then only
+// nest on it. refresh() moves the pin to the current epoch every 'interval'
+// calls so reclamation still makes progress; nothing read before a refresh
+// may be used after it.
+class Session {
+public:
+    template <typename T>
+    Session(ConcurrentBridge<T>* bridge, uint32_t interval = 64)
+            : owed(bridge->bind()),
+              interval(std::max<uint32_t>(interval, 1)),
+              countdown(this->interval) {
+        owed->lock_guard();
+    }
+
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    ~Session() { owed->unguard(); }
+
+    void refresh() {
+        if (--countdown == 0) {
+            countdown = interval;
+            owed->refresh();
+        }
+    }
+
+private:
+    ThreadHandle* owed;
+    const uint32_t interval;
+    uint32_t countdown;
+};
+
 using Pin = PackedHandle;
 } // namespace sebr
@@ -1437,6 +1437,870 @@ void test14() {
     delete[] keys;
 }
 
+// counts live values, so tests can check that retired ones were freed.
+struct Tracked {
+    static std::atomic<long> live;
+
+    long v;
+
+    Tracked(long v = 0) : v(v) { live.fetch_add(1); }
+    Tracked(const Tracked& o) : v(o.v) { live.fetch_add(1); }
+    Tracked& operator=(const Tracked& o) = default;
+    ~Tracked() { live.fetch_sub(1); }
+
+    bool operator==(const Tracked& o) const { return v == o.v; }
+};
+
+std::atomic<long> Tracked::live(0);
+
+struct InlinePair {
+    long first;
+    long second;
+
+    bool operator==(const InlinePair& o) const { return first == o.first && second == o.second; }
+};
+
+// test for inline (atomic / seqlock) values.
+void test15() {
+    std::cout << "Test ConcurrentHashMap with inline values" << std::endl;
+    ConcurrentHashMap<long, long> conMap;
+    ConcurrentHashMap<long, InlinePair> pairMap;
+    std::vector<std::thread> threads;
+    int n = n_const / 10;
+    int32_t nthreads = nthreads_const;
+    std::cout << "threads: " << nthreads << std::endl;
+    std::cout << "num of k/v(s): " << n << std::endl;
+
+    auto beginTime = std::chrono::high_resolution_clock::now();
+    for (int j = 0, pro = nthreads; j < pro; ++j) {
+        threads.emplace_back([&conMap, &pairMap, n, pro, j] {
+            for (int i = 0; i < n / pro; ++i) {
+                long key = i * pro + j;
+                conMap.insertAbsent(key, key);
+                pairMap.insertAbsent(key, InlinePair{key, ~key});
+            }
+        });
+    }
+
+    for (std::thread& th : threads) th.join();
+    threads.clear();
+
+    // overwrite values while readers check that they never see a torn pair.
+    for (int j = 0, pro = nthreads; j < pro; ++j) {
+        threads.emplace_back([&conMap, &pairMap, n, pro, j] {
+            for (int i = 0; i < n / pro; ++i) {
+                long key = i * pro + j;
+                long value = key + 1;
+                InlinePair pair{key + 1, ~(key + 1)};
+                bool r;
+                r = conMap.insert(key, &value);
+                assert(r && value == key);
+                r = pairMap.insert(key, &pair);
+                assert(r && pair.first == key && pair.second == ~key);
+            }
+        });
+        threads.emplace_back([&pairMap, n, pro] {
+            for (int i = 0; i < (n / pro) * pro; ++i) {
+                InlinePair pair;
+                bool r;
+                r = pairMap.find(i, &pair);
+                assert(r && pair.second == ~pair.first);
+            }
+        });
+    }
+
+    for (std::thread& th : threads) th.join();
+    threads.clear();
+
+    for (int i = 0; i < (n / nthreads) * nthreads; ++i) {
+        long value = -1;
+        bool r;
+        r = conMap.find(i, &value);
+        assert(r && value == i + 1);
+        r = conMap.eraseEqual(i, i + 1);
+        assert(r);
+        r = pairMap.eraseEqual(i, InlinePair{i + 1, ~(i + 1L)});
+        assert(r);
+    }
+    assert(conMap.size() == 0 && pairMap.size() == 0);
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - beginTime);
+    std::cout << "inline values elapsed time is " << elapsedTime.count() << " milliseconds" << std::endl;
+}
+
+void test16() {
+    std::cout << "Test ConcurrentHashMap insert_bulk" << std::endl;
+    ConcurrentHashMap<long, long> conMap;
+    std::vector<std::thread> threads;
+    int n = n_const / 10;
+    int32_t nthreads = nthreads_const;
+    std::cout << "threads: " << nthreads << std::endl;
+    std::cout << "num of k/v(s): " << n << std::endl;
+
+    auto beginTime = std::chrono::high_resolution_clock::now();
+    std::atomic<long> added(0);
+    // every thread loads the same keys in its own order, so batches collide.
+    for (int j = 0, pro = nthreads; j < pro; ++j) {
+        threads.emplace_back([&conMap, &added, n, pro, j] {
+            std::vector<std::pair<long, long>> batch;
+            for (int i = 0; i < n; ++i) {
+                long key = (static_cast<long>(i) * (2 * j + 1)) % n;
+                batch.emplace_back(key, key);
+                // duplicates inside a batch: the first one wins.
+                if (i % 7 == 0) batch.emplace_back(key, -key - 1);
+                if (batch.size() >= 4096) {
+                    added.fetch_add(conMap.insert_bulk(batch.begin(), batch.end()));
+                    batch.clear();
+                }
+            }
+            added.fetch_add(conMap.insert_bulk(batch.begin(), batch.end()));
+        });
+    }
+
+    for (std::thread& th : threads) th.join();
+    assert(added.load() == n && conMap.size() == n);
+
+    for (int i = 0; i < n; ++i) {
+        long value = -1;
+        bool r;
+        r = conMap.find(i, &value);
+        assert(r && value == i);
+    }
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - beginTime);
+    std::cout << "insert_bulk elapsed time is " << elapsedTime.count() << " milliseconds" << std::endl;
+}
+
+void test17() {
+    std::cout << "Test ConcurrentHashMap clear" << std::endl;
+    ConcurrentHashMap<long, std::string> conMap;
+    std::vector<std::thread> threads;
+    int n = n_const / 10;
+    int32_t nthreads = nthreads_const;
+    std::cout << "threads: " << nthreads << std::endl;
+    std::cout << "num of k/v(s): " << n << std::endl;
+
+    auto beginTime = std::chrono::high_resolution_clock::now();
+    std::atomic<bool> done(false);
+    for (int j = 0, pro = nthreads; j < pro; ++j) {
+        threads.emplace_back([&conMap, n, pro, j] {
+            for (int i = 0; i < n / pro; ++i) {
+                long key = i * pro + j;
+                conMap.insertAbsent(key, std::to_string(key));
+                std::string value;
+                if (conMap.find(key, &value)) {
+                    assert(value == std::to_string(key));
+                }
+                if (i % 3 == 0) conMap.erase(key, &value);
+            }
+        });
+    }
+    std::thread clearer([&conMap, &done] {
+        for (unsigned int workers = 1; !done.load(); workers = workers % 4 + 1) {
+            conMap.clear(workers);
+            std::this_thread::yield();
+        }
+    });
+
+    for (std::thread& th : threads) th.join();
+    done.store(true);
+    clearer.join();
+
+    long found = 0;
+    for (int i = 0; i < (n / nthreads) * nthreads; ++i) {
+        std::string value;
+        if (conMap.find(i, &value)) ++found;
+    }
+    assert(conMap.size() == found);
+
+    conMap.clear(nthreads);
+    assert(conMap.empty());
+    for (int i = 0; i < (n / nthreads) * nthreads; ++i) {
+        std::string value;
+        bool r;
+        r = conMap.find(i, &value);
+        assert(!r);
+    }
+
+    // a large clear torn down through the executor once the record is reclaimed.
+    auto bigMap = new ConcurrentHashMap<long, Tracked>();
+    std::atomic<int> tasks(0);
+    bigMap->set_dispose_workers(nthreads, [&tasks](std::function<void()> task) {
+        tasks.fetch_add(1);
+        std::thread(std::move(task)).detach();
+    });
+    // well over DISPOSE_STRIDE non-empty bins, so the teardown is striped.
+    for (int i = 0; i < (1 << 15); ++i) {
+        bigMap->insertAbsent(i, Tracked(i));
+    }
+    bigMap->clear(nthreads);
+    assert(bigMap->empty());
+    delete bigMap;
+    assert(Tracked::live.load() == 0);
+    assert(nthreads == 1 || tasks.load() > 0);
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - beginTime);
+    std::cout << "clear elapsed time is " << elapsedTime.count() << " milliseconds" << std::endl;
+}
+
+void test18() {
+    std::cout << "Test ConcurrentHashMap parallel destruction" << std::endl;
+    int n = n_const / 4;
+    int32_t nthreads = std::max(nthreads_const, 2);
+
+    for (int mode = 0; mode < 3; ++mode) {
+        auto conMap = new ConcurrentHashMap<long, Tracked>();
+        for (int i = 0; i < std::max(n, 1 << 15); ++i) {
+            conMap->insertAbsent(i, Tracked(i));
+        }
+
+        std::atomic<int> tasks(0);
+        if (mode == 1) {
+            conMap->set_dispose_workers(nthreads);
+        } else if (mode == 2) {
+            conMap->set_dispose_workers(nthreads, [&tasks](std::function<void()> task) {
+                tasks.fetch_add(1);
+                std::thread(std::move(task)).detach();
+            });
+        }
+
+        auto beginTime = std::chrono::high_resolution_clock::now();
+        delete conMap;
+        auto endTime = std::chrono::high_resolution_clock::now();
+        auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - beginTime);
+        std::cout << (mode == 0 ? "sequential" : mode == 1 ? "threads" : "executor")
+                  << " destruction elapsed time is " << elapsedTime.count() << " milliseconds" << std::endl;
+
+        // every value is gone once the destructor returns, whoever took the stripes.
+        assert(Tracked::live.load() == 0);
+        assert(tasks.load() == (mode == 2 ? nthreads - 1 : 0));
+    }
+}
+
+void test19() {
+    std::cout << "Test ConcurrentHashMap transparent lookup" << std::endl;
+    ConcurrentHashMap<std::string, long, StringHash, std::equal_to<>> conMap;
+    std::vector<std::thread> threads;
+    int n = n_const / 10;
+    int32_t nthreads = nthreads_const;
+    std::cout << "threads: " << nthreads << std::endl;
+    std::cout << "num of k/v(s): " << n << std::endl;
+
+    for (int i = 0; i < n; ++i) {
+        conMap.insertAbsent("doris" + std::to_string(i), i);
+    }
+
+    auto beginTime = std::chrono::high_resolution_clock::now();
+    for (int j = 0, pro = nthreads; j < pro; ++j) {
+        threads.emplace_back([&conMap, n, pro, j] {
+            char buf[32];
+            for (int i = 0; i < n / pro; ++i) {
+                int key = i * pro + j;
+                int len = snprintf(buf, sizeof(buf), "doris%d", key);
+                long value = -1;
+                bool r;
+                r = conMap.find(std::string_view(buf, len), &value);
+                assert(r && value == key);
+                r = conMap.find(static_cast<const char*>(buf), &value);
+                assert(r && value == key);
+                auto ref = conMap.find_reference(std::string_view(buf, len));
+                assert(ref.is_data() && ref.key() == buf && ref.val() == key);
+                if (key % 2 == 0) {
+                    r = conMap.erase(std::string_view(buf, len), &value);
+                    assert(r && value == key);
+                } else {
+                    r = conMap.eraseEqual(static_cast<const char*>(buf), key + 1);
+                    assert(!r);
+                }
+            }
+        });
+    }
+
+    for (std::thread& th : threads) th.join();
+    // the even keys among the ones the threads visited are gone.
+    assert(conMap.size() == n - ((n / nthreads) * nthreads + 1) / 2);
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - beginTime);
+    std::cout << "transparent lookup elapsed time is " << elapsedTime.count() << " milliseconds" << std::endl;
+}
+
+// every key lands in the same bin, which becomes one big TreeBin.
+struct CollidingHash {
+    size_t operator()(long) const { return 42; }
+};
+
+struct UnorderedKey {
+    long v;
+
+    bool operator==(const UnorderedKey& o) const { return v == o.v; }
+};
+
+struct UnorderedKeyHash {
+    size_t operator()(const UnorderedKey&) const { return 42; }
+};
+
+// strings that are equal ignoring case, which operator< on std::string does not.
+struct CaseInsensitiveHash {
+    size_t operator()(const std::string&) const { return 42; }
+};
+
+struct CaseInsensitiveEqual {
+    bool operator()(const std::string& a, const std::string& b) const {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+                   return std::tolower(static_cast<unsigned char>(x)) ==
+                          std::tolower(static_cast<unsigned char>(y));
+               });
+    }
+};
+
+// test for TreeBins of colliding keys, ordered by operator< or not.
+void test20() {
+    std::cout << "Test ConcurrentHashMap with colliding keys" << std::endl;
+    ConcurrentHashMap<long, long, CollidingHash> conMap;
+    ConcurrentHashMap<UnorderedKey, long, UnorderedKeyHash> unorderedMap;
+    std::vector<std::thread> threads;
+    int n = n_const / 1000;
+    int32_t nthreads = nthreads_const;
+    std::cout << "threads: " << nthreads << std::endl;
+    std::cout << "num of k/v(s): " << n << std::endl;
+
+    auto beginTime = std::chrono::high_resolution_clock::now();
+    for (int j = 0, pro = nthreads; j < pro; ++j) {
+        threads.emplace_back([&conMap, &unorderedMap, n, pro, j] {
+            for (int i = 0; i < n / pro; ++i) {
+                long key = i * pro + j;
+                conMap.insertAbsent(key, key);
+                if (i < 64) unorderedMap.insertAbsent(UnorderedKey{key}, key);
+            }
+        });
+    }
+
+    for (std::thread& th : threads) th.join();
+    threads.clear();
+
+    for (int j = 0, pro = nthreads; j < pro; ++j) {
+        threads.emplace_back([&conMap, &unorderedMap, n, pro, j] {
+            for (int i = 0; i < n / pro; ++i) {
+                long key = i * pro + j;
+                long value = -1;
+                bool r;
+                r = conMap.find(key, &value);
+                assert(r && value == key);
+                r = conMap.find(-key - 1, &value);
+                assert(!r);
+                if (i < 64) {
+                    r = unorderedMap.find(UnorderedKey{key}, &value);
+                    assert(r && value == key);
+                }
+                if (key % 2 == 0) {
+                    r = conMap.erase(key, &value);
+                    assert(r && value == key);
+                }
+            }
+        });
+    }
+
+    for (std::thread& th : threads) th.join();
+    int m = (n / nthreads) * nthreads;
+    assert(conMap.size() == m / 2);
+    for (int i = 0; i < m; ++i) {
+        long value = -1;
+        bool r;
+        r = conMap.find(i, &value);
+        assert(r == (i % 2 == 1));
+    }
+    threads.clear();
+
+    // churn the even keys while readers check that the odd ones never go missing.
+    std::atomic<int> writers(nthreads);
+    for (int j = 0, pro = nthreads; j < pro; ++j) {
+        threads.emplace_back([&conMap, &writers, m, pro, j] {
+            for (int round = 0; round < 4; ++round) {
+                for (int i = j * 2; i < m; i += 2 * pro) {
+                    long value = -1;
+                    conMap.insertAbsent(i, i);
+                    if (round % 2 == 1) conMap.erase(i, &value);
+                }
+            }
+            writers.fetch_sub(1);
+        });
+        threads.emplace_back([&conMap, &writers, m, j] {
+            for (long i = 2 * j + 1; writers.load() > 0; i += 2) {
+                long value = -1;
+                bool r;
+                long key = i % m | 1;
+                if (key >= m) continue;
+                r = conMap.find(key, &value);
+                assert(r && value == key);
+            }
+        });
+    }
+
+    for (std::thread& th : threads) th.join();
+    assert(conMap.size() == m / 2);
+
+    // a key spelled in another case must still be found, and not be added twice.
+    ConcurrentHashMap<std::string, long, CaseInsensitiveHash, CaseInsensitiveEqual> caseMap;
+    for (int i = 0; i < 64; ++i) {
+        caseMap.insertAbsent((i % 2 == 0 ? "key" : "KEY") + std::to_string(i), i);
+    }
+    for (int i = 0; i < 64; ++i) {
+        long value = -1;
+        bool r;
+        r = caseMap.find((i % 2 == 0 ? "KEY" : "key") + std::to_string(i), &value);
+        assert(r && value == i);
+        r = caseMap.insertAbsent("Key" + std::to_string(i), -1);
+        assert(!r);
+    }
+    assert(caseMap.size() == 64);
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - beginTime);
+    std::cout << "colliding keys elapsed time is " << elapsedTime.count() << " milliseconds" << std::endl;
+}
+
+// short-lived threads leave their retired nodes behind; a live thread adopts and frees them.
+void test21() {
+    std::cout << "Test ConcurrentHashMap orphaned garbage adoption" << std::endl;
+    ConcurrentHashMap<long, Tracked> conMap;
+    std::vector<std::thread> threads;
+    int n = n_const / 10;
+    int32_t nthreads = nthreads_const;
+    std::cout << "threads: " << nthreads << std::endl;
+    std::cout << "num of k/v(s): " << n << std::endl;
+
+    const int rounds = 4;
+    long orphaned = 0;
+    auto beginTime = std::chrono::high_resolution_clock::now();
+    {
+        // holding a pin keeps the workers from freeing anything, so all they
+        // retire is still pending when they exit.
+        Pin pin(&conMap);
+        for (int round = 0; round < rounds; ++round) {
+            for (int j = 0, pro = nthreads; j < pro; ++j) {
+                threads.emplace_back([&conMap, n, pro, j] {
+                    for (int i = j; i < n; i += pro) {
+                        Tracked value;
+                        conMap.insertAbsent(i, Tracked(i));
+                        bool r = conMap.erase(i, &value);
+                        assert(r && value.v == i);
+                        (void)r;
+                    }
+                });
+            }
+            for (std::thread& th : threads) th.join();
+            threads.clear();
+        }
+        orphaned = Tracked::live.load();
+        assert(orphaned == static_cast<long>(rounds) * n);
+    }
+
+    // releasing the pin runs a reclaim pass on this thread, which adopts the
+    // orphans; afterwards no more than its own limbo is left: below the gc
+    // threshold plus one epoch's worth of records, each a node of more than a
+    // key and a value.
+    using Bridge = ConcurrentBridge<ConcurrentHashMap<long, Tracked>>;
+    const long limboBound = (Bridge::DEFAULT_GC_THRESHOLD + Bridge::DEFAULT_EPOCH_THRESHOLD) /
+                                    (sizeof(long) + sizeof(Tracked)) + 2;
+    long adopted = Tracked::live.load();
+    std::cout << "pending values: " << orphaned << " -> " << adopted << std::endl;
+    assert(adopted <= limboBound);
+    assert(conMap.size() == 0);
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - beginTime);
+    std::cout << "orphan adoption elapsed time is " << elapsedTime.count() << " milliseconds" << std::endl;
+}
+
+// expired records are freed by a background reclaimer instead of the unpinning thread.
+void test22() {
+    std::cout << "Test ConcurrentHashMap background reclamation" << std::endl;
+    int n = n_const / 10;
+    int32_t nthreads = nthreads_const;
+    std::cout << "threads: " << nthreads << std::endl;
+    std::cout << "num of k/v(s): " << n << std::endl;
+
+    for (int mode = 0; mode < 2; ++mode) {
+        auto conMap = new ConcurrentHashMap<long, Tracked>();
+        bool r = mode == 0 ? conMap->reclaim_in_background()
+                           : conMap->reclaim_in_background([](std::function<void()> task) {
+                                 std::thread(std::move(task)).detach();
+                             });
+        assert(r);
+        r = conMap->reclaim_in_background();
+        assert(!r);
+        (void)r;
+
+        std::vector<std::thread> threads;
+        auto beginTime = std::chrono::high_resolution_clock::now();
+        for (int j = 0, pro = nthreads; j < pro; ++j) {
+            threads.emplace_back([conMap, n, pro, j] {
+                for (int round = 0; round < 4; ++round) {
+                    for (int i = j; i < n; i += pro) {
+                        Tracked value;
+                        conMap->insertAbsent(i, Tracked(i));
+                        if (round % 2 == 1) {
+                            bool r = conMap->erase(i, &value);
+                            assert(r && value.v == i);
+                            (void)r;
+                        }
+                    }
+                }
+            });
+        }
+        for (std::thread& th : threads) th.join();
+        assert(conMap->size() == 0);
+        delete conMap;
+        assert(Tracked::live.load() == 0);
+
+        auto endTime = std::chrono::high_resolution_clock::now();
+        auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - beginTime);
+        std::cout << (mode == 0 ? "reclaimer thread" : "executor")
+                  << " elapsed time is " << elapsedTime.count() << " milliseconds" << std::endl;
+    }
+}
+
+// each unguard frees a bounded amount; later ones, even plain finds, continue the work.
+void test23() {
+    std::cout << "Test ConcurrentHashMap bounded reclamation" << std::endl;
+    int n = n_const / 10;
+    int32_t nthreads = nthreads_const;
+    std::cout << "threads: " << nthreads << std::endl;
+    std::cout << "num of k/v(s): " << n << std::endl;
+
+    auto conMap = new ConcurrentHashMap<long, Tracked>(512);
+    std::vector<std::thread> threads;
+    auto beginTime = std::chrono::high_resolution_clock::now();
+    for (int j = 0, pro = nthreads; j < pro; ++j) {
+        threads.emplace_back([conMap, n, pro, j] {
+            for (int i = j; i < n; i += pro) {
+                conMap->insertAbsent(i, Tracked(i));
+            }
+            for (int i = j; i < n; i += pro) {
+                Tracked value;
+                bool r = conMap->erase(i, &value);
+                assert(r && value.v == i);
+                (void)r;
+            }
+        });
+    }
+    for (std::thread& th : threads) th.join();
+    conMap->clear();
+    assert(conMap->size() == 0);
+
+    // an open iterator holds back everything retired meanwhile. Releasing it
+    // adopts the writer's backlog, and the finds after it (which retire
+    // nothing) work that off one budget at a time.
+    long pending;
+    {
+        auto ite = conMap->begin();
+        std::thread([conMap, n] {
+            for (int i = 0; i < n; ++i) {
+                Tracked value;
+                conMap->insertAbsent(i, Tracked(i));
+                conMap->erase(i, &value);
+            }
+        }).join();
+        pending = Tracked::live.load();
+    }
+    long left = Tracked::live.load();
+    for (int i = 0; i < n; ++i) {
+        Tracked value;
+        bool r = conMap->find(i, &value);
+        assert(!r);
+        (void)r;
+    }
+    long drained = Tracked::live.load();
+    std::cout << "pending values: " << pending << " -> " << left << " -> " << drained << std::endl;
+
+    // each record is a node of more than a key and a value, so one pass frees
+    // at most a budget's worth of them (and at least one); all the passes
+    // together leave no more than the thread's own limbo: below the gc
+    // threshold plus one epoch's worth of records.
+    using Bridge = ConcurrentBridge<ConcurrentHashMap<long, Tracked>>;
+    const long recordBytes = sizeof(long) + sizeof(Tracked);
+    const long budgetBound = 512 / recordBytes + 1;
+    const long limboBound =
+            (Bridge::DEFAULT_GC_THRESHOLD + Bridge::DEFAULT_EPOCH_THRESHOLD) / recordBytes + 2;
+    assert(pending > left && pending - left <= budgetBound);
+    assert(drained <= limboBound);
+    delete conMap;
+    assert(Tracked::live.load() == 0);
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - beginTime);
+    std::cout << "bounded reclamation elapsed time is " << elapsedTime.count() << " milliseconds" << std::endl;
+}
+
+// finds nested inside an iteration must not end the iterator's pin.
+void test24() {
+    std::cout << "Test ConcurrentHashMap nested pins" << std::endl;
+    ConcurrentHashMap<long, Tracked> conMap;
+    int n = n_const / 10;
+    std::cout << "num of k/v(s): " << n << std::endl;
+
+    for (int i = 0; i < n; ++i) {
+        conMap.insertAbsent(i, Tracked(i));
+    }
+
+    auto beginTime = std::chrono::high_resolution_clock::now();
+    std::atomic<bool> iterating(true);
+    std::thread writer([&conMap, &iterating, n] {
+        while (iterating.load()) {
+            for (int i = 0; i < n; ++i) {
+                Tracked value;
+                conMap.erase(i, &value);
+                conMap.insertAbsent(i, Tracked(i));
+            }
+        }
+    });
+
+    long visited = 0;
+    for (int round = 0; round < 4; ++round) {
+        auto copy = conMap.end();
+        for (auto ite = conMap.begin(); ite != conMap.end(); ++ite) {
+            Tracked value;
+            conMap.find(ite.key(), &value);
+            assert(ite.val().v == ite.key());
+            if (visited++ % 64 == 0) {
+                copy = ite;
+            }
+        }
+        assert(copy == conMap.end() || copy.val().v == copy.key());
+    }
+    iterating.store(false);
+    writer.join();
+    std::cout << "visited: " << visited << std::endl;
+
+    // under the iterator's pin the nested ones neither unpublish the epoch nor
+    // reclaim, so everything retired meanwhile is still pending, including the
+    // node the iterator sits on.
+    {
+        auto ite = conMap.begin();
+        long before = Tracked::live.load();
+        for (int round = 0; round < 4; ++round) {
+            for (int i = 0; i < n; ++i) {
+                Tracked value;
+                conMap.erase(i, &value);
+                conMap.insertAbsent(i, Tracked(i));
+            }
+        }
+        assert(Tracked::live.load() - before == 4L * n);
+        assert(ite != conMap.end() && ite.val().v == ite.key());
+    }
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - beginTime);
+    std::cout << "nested pins elapsed time is " << elapsedTime.count() << " milliseconds" << std::endl;
+}
+
+// a batch of finds under one Session, refreshed every few operations.
+void test25() {
+    std::cout << "Test ConcurrentHashMap batch reads in a session" << std::endl;
+    ConcurrentHashMap<long, Tracked> conMap;
+    int n = n_const / 10;
+    std::cout << "num of k/v(s): " << n << std::endl;
+
+    for (int i = 0; i < n; ++i) {
+        conMap.insertAbsent(i, Tracked(i));
+    }
+
+    std::atomic<bool> reading(true);
+    std::thread writer([&conMap, &reading, n] {
+        while (reading.load()) {
+            for (int i = 0; i < n; ++i) {
+                Tracked value;
+                conMap.erase(i, &value);
+                conMap.insertAbsent(i, Tracked(i));
+            }
+        }
+    });
+
+    for (int mode = 0; mode < 2; ++mode) {
+        long found = 0;
+        auto beginTime = std::chrono::high_resolution_clock::now();
+        if (mode == 0) {
+            for (int round = 0; round < 16; ++round) {
+                for (int i = 0; i < n; ++i) {
+                    Tracked value;
+                    found += conMap.find(i, &value);
+                }
+            }
+        } else {
+            Session session(&conMap, 256);
+            for (int round = 0; round < 16; ++round) {
+                for (int i = 0; i < n; ++i) {
+                    Tracked value;
+                    found += conMap.find(i, &value);
+                    session.refresh();
+                }
+            }
+        }
+        auto endTime = std::chrono::high_resolution_clock::now();
+        auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - beginTime);
+        std::cout << (mode == 0 ? "pin per find" : "session") << " found " << found
+                  << ", elapsed time is " << elapsedTime.count() << " milliseconds" << std::endl;
+    }
+    reading.store(false);
+    writer.join();
+
+    // a session pinned before the churn holds back everything it retires
+    // until refresh() moves the pin; then all but the records of the current
+    // epoch are freed. Each record is a node of more than a key and a value.
+    const int rounds = 4;
+    const long epochBound =
+            ConcurrentBridge<ConcurrentHashMap<long, Tracked>>::DEFAULT_EPOCH_THRESHOLD /
+                    (sizeof(long) + sizeof(Tracked)) + 1;
+    {
+        Session session(&conMap, 16);
+        long before = Tracked::live.load();
+        std::thread churner([&conMap, n, rounds] {
+            for (int round = 0; round < rounds; ++round) {
+                for (int i = 0; i < n; ++i) {
+                    Tracked value;
+                    conMap.erase(i, &value);
+                    conMap.insertAbsent(i, Tracked(i));
+                }
+            }
+        });
+        churner.join();
+        long held = Tracked::live.load() - before;
+        assert(held == static_cast<long>(rounds) * n);
+
+        for (int i = 0; i < 16; ++i) {
+            session.refresh();
+        }
+        long pending = Tracked::live.load() - n;
+        std::cout << "pending values: " << held << " -> " << pending << std::endl;
+        assert(pending <= epochBound);
+    }
+}
+
+// a thread binding to many short-lived maps reuses the slots of dead groups and
+// sweeps them, while the handle of a map it keeps using stays intact.
+void test26() {
+    std::cout << "Test ConcurrentHashMap handles of short-lived maps" << std::endl;
+    int rounds = 16;
+    int maps = 200;
+    int n = 16;
+    std::cout << "rounds: " << rounds << ", maps per round: " << maps << std::endl;
+
+    auto beginTime = std::chrono::high_resolution_clock::now();
+    ConcurrentHashMap<long, long> anchor;
+    std::thread([&anchor, rounds, maps, n] {
+        std::vector<ConcurrentHashMap<long, Tracked>*> conMaps;
+        for (int round = 0; round < rounds; ++round) {
+            for (int m = 0; m < maps; ++m) {
+                auto conMap = new ConcurrentHashMap<long, Tracked>();
+                for (int i = 0; i < n; ++i) {
+                    conMap->insertAbsent(i, Tracked(round));
+                }
+                for (int i = 0; i < n; i += 2) {
+                    Tracked value;
+                    bool r = conMap->erase(i, &value);
+                    assert(r && value.v == round);
+                    (void)r;
+                }
+                conMaps.push_back(conMap);
+            }
+            anchor.insertAbsent(round, round);
+
+            // every map binds this thread to a group of its own.
+            for (auto conMap : conMaps) {
+                Tracked value;
+                bool r = conMap->find(1, &value);
+                assert(r && value.v == round && conMap->size() == n / 2);
+                (void)r;
+                delete conMap;
+            }
+            conMaps.clear();
+            assert(Tracked::live.load() == 0);
+        }
+    }).join();
+
+    assert(anchor.size() == rounds);
+    for (int round = 0; round < rounds; ++round) {
+        long value = -1;
+        bool r = anchor.find(round, &value);
+        assert(r && value == round);
+        (void)r;
+    }
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - beginTime);
+    std::cout << "short-lived maps elapsed time is " << elapsedTime.count() << " milliseconds" << std::endl;
+}
+
+// maps are torn down while the threads bound to them live on and bind to new
+// ones, which sweeps or rebuilds the slots the teardown just handed back.
+void test27() {
+    std::cout << "Test ConcurrentHashMap teardown under live threads" << std::endl;
+    int rounds = 64;
+    int maps = 64;
+    int32_t nthreads = nthreads_const;
+    std::cout << "threads: " << nthreads << std::endl;
+    std::cout << "rounds: " << rounds << ", maps per round: " << maps << std::endl;
+
+    auto beginTime = std::chrono::high_resolution_clock::now();
+    std::vector<std::vector<ConcurrentHashMap<long, Tracked>*>> batches(rounds);
+    std::atomic<int> published(-1);
+    std::atomic<int> acks(0);
+    std::vector<std::thread> threads;
+    for (int j = 0; j < nthreads; ++j) {
+        threads.emplace_back([&batches, &published, &acks, rounds, j] {
+            for (int seen = -1;;) {
+                int g = published.load();
+                if (g == seen) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                if (g == rounds) break;
+                for (auto conMap : batches[g]) {
+                    Tracked value;
+                    conMap->insertAbsent(j, Tracked(j));
+                    bool r = conMap->find(j, &value);
+                    assert(r && value.v == j);
+                    r = conMap->erase(j, &value);
+                    assert(r && value.v == j);
+                    (void)r;
+                }
+                seen = g;
+                acks.fetch_add(1);
+            }
+        });
+    }
+
+    for (int g = 0; g <= rounds; ++g) {
+        if (g < rounds) {
+            for (int m = 0; m < maps; ++m) {
+                batches[g].push_back(new ConcurrentHashMap<long, Tracked>());
+            }
+        }
+        while (acks.load() < nthreads * g) {
+            std::this_thread::yield();
+        }
+        published.store(g);
+        // the workers are binding to the next batch meanwhile.
+        if (g > 0) {
+            for (auto conMap : batches[g - 1]) {
+                assert(conMap->size() == 0);
+                delete conMap;
+            }
+        }
+    }
+    for (std::thread& th : threads) th.join();
+    assert(Tracked::live.load() == 0);
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - beginTime);
+    std::cout << "teardown under live threads elapsed time is " << elapsedTime.count() << " milliseconds"
+              << std::endl;
+}
+
 void test_scalable_hashtable(int i) {
     std::cout << "\n\nIterator " << i << " test!" << std::endl;
     std::cout << "test1\n";
@@ -1468,6 +2332,32 @@ void test_scalable_hashtable(int i) {
     test13();
     std::cout << "test14\n";
     test14();
+    std::cout << "test15\n";
+    test15();
+    std::cout << "test16\n";
+    test16();
+    std::cout << "test17\n";
+    test17();
+    std::cout << "test18\n";
+    test18();
+    std::cout << "test19\n";
+    test19();
+    std::cout << "test20\n";
+    test20();
+    std::cout << "test21\n";
+    test21();
+    std::cout << "test22\n";
+    test22();
+    std::cout << "test23\n";
+    test23();
+    std::cout << "test24\n";
+    test24();
+    std::cout << "test25\n";
+    test25();
+    std::cout << "test26\n";
+    test26();
+    std::cout << "test27\n";
+    test27();
 
     std::cout << "test over\n";
     std::cout << "\n\n";